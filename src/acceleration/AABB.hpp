@@ -0,0 +1,116 @@
+/*
+ * Name: AABB
+ * Description: Axis aligned bounding box used by the acceleration structures to bound
+ * primitives and groups of primitives.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+/**
+ * AABB struct defines an axis aligned box by its minimum and maximum corners. A default
+ * constructed box is empty, so extending it with any point or box yields that point/box.
+ */
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    AABB()
+        : min(std::numeric_limits<float>::max()),
+          max(-std::numeric_limits<float>::max())
+    {}
+
+    AABB(const glm::vec3& pmin, const glm::vec3& pmax)
+        : min(pmin),
+          max(pmax)
+    {}
+
+    // Grow the box to contain point p
+    void extend(const glm::vec3& p)
+    {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    // Grow the box to contain another box
+    void extend(const AABB& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    [[nodiscard]] bool isEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    [[nodiscard]] glm::vec3 centroid() const
+    {
+        return 0.5f * (min + max);
+    }
+
+    [[nodiscard]] glm::vec3 extent() const
+    {
+        return max - min;
+    }
+
+    // Surface area of the box, used as the probability of a ray hitting it in the SAH
+    [[nodiscard]] float surfaceArea() const
+    {
+        if (isEmpty())
+        {
+            return 0.0f;
+        }
+
+        const glm::vec3 d = extent();
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    // Bounding box of this box after transforming it by T
+    [[nodiscard]] AABB transformed(const glm::mat4& T) const
+    {
+        AABB result;
+        if (isEmpty())
+        {
+            return result;
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? max.x : min.x,
+                             (i & 2) ? max.y : min.y,
+                             (i & 4) ? max.z : min.z);
+            result.extend(glm::vec3(T * glm::vec4(corner, 1.0f)));
+        }
+        return result;
+    }
+
+    /**
+     * intersect performs a slab test of the ray against the box.
+     * @param origin Ray origin
+     * @param invDir Component-wise reciprocal of the ray direction
+     * @param tMax Only hits closer than tMax are reported
+     * @param tNear Set to the parametric distance at which the ray enters the box
+     * @return True if the ray overlaps the box somewhere in [0, tMax]
+     */
+    bool intersect(
+        const glm::vec3& origin,
+        const glm::vec3& invDir,
+        const float tMax,
+        float& tNear
+    ) const
+    {
+        const glm::vec3 t0 = (min - origin) * invDir;
+        const glm::vec3 t1 = (max - origin) * invDir;
+        const glm::vec3 tSmall = glm::min(t0, t1);
+        const glm::vec3 tBig = glm::max(t0, t1);
+
+        tNear = std::max(std::max(tSmall.x, tSmall.y), std::max(tSmall.z, 0.0f));
+        const float tFar = std::min(std::min(tBig.x, tBig.y), std::min(tBig.z, tMax));
+        return tNear <= tFar;
+    }
+};
@@ -0,0 +1,414 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <thread>
+
+// Relative cost of traversing a node compared to intersecting a primitive in the SAH
+const float TRAVERSAL_COST = 1.0f;
+
+// Nodes with at most this many primitives may become leaves
+const uint32_t MAX_LEAF_SIZE = 4;
+
+// Number of bins along each axis that candidate splits are placed between
+const int NUM_BINS = 32;
+
+// Nodes with at least this many primitives bin their centroids across all threads
+const uint32_t PARALLEL_BIN_SIZE = 1 << 16;
+
+// Nodes with fewer primitives than this are built as a single subtree task
+const uint32_t MIN_SUBTREE_SIZE = 1 << 10;
+
+// Number of subtree tasks to split the top of the tree into for every thread, so threads
+// that finish early can take another task
+const size_t SUBTREES_PER_THREAD = 4;
+
+/**
+ * Bins counts the primitives whose centroids fall in each bin along each axis, and the
+ * bounding box of those primitives.
+ */
+struct Bins {
+    AABB bounds[3][NUM_BINS];
+    uint32_t counts[3][NUM_BINS] = {};
+
+    void merge(const Bins& other)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int i = 0; i < NUM_BINS; i++)
+            {
+                bounds[axis][i].extend(other.bounds[axis][i]);
+                counts[axis][i] += other.counts[axis][i];
+            }
+        }
+    }
+};
+
+//---------------------------------------------------------------------------------------
+/**
+ * parallelChunks splits the range [first, first + count) into one chunk per thread and
+ * calls function(chunk, begin, end) for each chunk, the first on the calling thread.
+ * @param first Start of the range
+ * @param count Size of the range
+ * @param numThreads Number of chunks to split the range into
+ * @param function Callable as void(unsigned int chunk, uint32_t begin, uint32_t end)
+ */
+template<typename Function>
+void parallelChunks(
+    const uint32_t first,
+    const uint32_t count,
+    const unsigned int numThreads,
+    Function&& function
+)
+{
+    const uint32_t chunkSize = (count + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < numThreads; i++)
+    {
+        const uint32_t begin = first + std::min(count, i * chunkSize);
+        const uint32_t end = first + std::min(count, (i + 1) * chunkSize);
+        threads.emplace_back(function, i, begin, end);
+    }
+    function(0u, first, first + std::min(count, chunkSize));
+
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * build constructs the hierarchy over the given primitive bounding boxes. Primitive i in
+ * the hierarchy refers to primitiveBounds[i]. The top levels are split on the calling
+ * thread, binning large nodes across all threads, and the subtrees below are then built
+ * as independent tasks. The result does not depend on the number of threads.
+ * @param primitiveBounds Bounding box of every primitive
+ * @param numThreads Number of threads to build with
+ * @param leafBlockSize Number of primitives the caller intersects at once, e.g. with SIMD,
+ * so the SAH charges a partly filled block as much as a full one
+ */
+void BVH::build(
+    const std::vector<AABB>& primitiveBounds,
+    const unsigned int numThreads,
+    const uint32_t leafBlockSize
+)
+{
+    m_nodes.clear();
+    m_leafBlockSize = std::max(leafBlockSize, 1u);
+    m_primitiveIndices.resize(primitiveBounds.size());
+    std::iota(m_primitiveIndices.begin(), m_primitiveIndices.end(), 0);
+
+    if (primitiveBounds.empty())
+    {
+        return;
+    }
+
+    // Centroids decide which side of a split a primitive falls on
+    std::vector<glm::vec3> centroids;
+    centroids.reserve(primitiveBounds.size());
+    AABB rootBounds;
+    for (const AABB& bounds: primitiveBounds)
+    {
+        centroids.push_back(bounds.centroid());
+        rootBounds.extend(bounds);
+    }
+
+    // A binary tree over n primitives has at most 2n - 1 nodes
+    m_nodes.reserve(2 * primitiveBounds.size() - 1);
+    m_nodes.push_back({rootBounds, 0, static_cast<uint32_t>(primitiveBounds.size())});
+
+    // Split the largest node until there are enough subtrees to keep every thread busy
+    std::vector<std::pair<uint32_t, int>> open = {{0, 1}}; // Node index and depth
+    std::vector<std::pair<uint32_t, int>> subtrees;
+    const size_t numSubtrees = (numThreads > 1) ? SUBTREES_PER_THREAD * numThreads : 1;
+    while (!open.empty())
+    {
+        auto largest = std::max_element(
+            open.begin(), open.end(),
+            [this](const std::pair<uint32_t, int>& a, const std::pair<uint32_t, int>& b) {
+                return m_nodes[a.first].count < m_nodes[b.first].count;
+            });
+        const auto [nodeIndex, depth] = *largest;
+        open.erase(largest);
+
+        if (open.size() + subtrees.size() + 1 < numSubtrees &&
+            m_nodes[nodeIndex].count >= MIN_SUBTREE_SIZE &&
+            split(m_nodes, nodeIndex, primitiveBounds, centroids, depth, numThreads))
+        {
+            open.emplace_back(m_nodes[nodeIndex].leftOrFirst, depth + 1);
+            open.emplace_back(m_nodes[nodeIndex].leftOrFirst + 1, depth + 1);
+        }
+        else
+        {
+            subtrees.emplace_back(nodeIndex, depth);
+        }
+    }
+
+    // Build each subtree into its own array of nodes, with its root at index 0
+    std::vector<std::vector<BVHNode>> subtreeNodes(subtrees.size());
+    std::atomic<size_t> nextSubtree(0);
+    auto buildSubtrees = [&]() {
+        for (size_t i = nextSubtree++; i < subtrees.size(); i = nextSubtree++)
+        {
+            const BVHNode& root = m_nodes[subtrees[i].first];
+            subtreeNodes[i].reserve(2 * root.count - 1);
+            subtreeNodes[i].push_back(root);
+            subdivide(subtreeNodes[i], 0, primitiveBounds, centroids, subtrees[i].second);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(static_cast<size_t>(numThreads), subtrees.size()); i++)
+    {
+        threads.emplace_back(buildSubtrees);
+    }
+    buildSubtrees();
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+
+    // Splice the subtrees in, replacing their leaves with their roots and appending the
+    // rest of their nodes (so local index 1 moves to the current end of m_nodes)
+    for (size_t i = 0; i < subtrees.size(); i++)
+    {
+        const auto offset = static_cast<uint32_t>(m_nodes.size() - 1);
+        for (BVHNode& node: subtreeNodes[i])
+        {
+            if (!node.isLeaf())
+            {
+                node.leftOrFirst += offset;
+            }
+        }
+
+        m_nodes[subtrees[i].first] = subtreeNodes[i][0];
+        m_nodes.insert(m_nodes.end(), subtreeNodes[i].begin() + 1, subtreeNodes[i].end());
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * intersectionCost estimates the cost of intersecting count primitives in the SAH, in
+ * units of a single primitive test. Primitives are tested in blocks of m_leafBlockSize.
+ */
+float BVH::intersectionCost(const uint32_t count) const
+{
+    return static_cast<float>((count + m_leafBlockSize - 1) / m_leafBlockSize);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * split splits a leaf node in two, choosing the split with the lowest SAH cost among
+ * the boundaries between centroid bins along the three axes. The node is left as a leaf
+ * if splitting would not lower the expected cost.
+ * @param nodes Nodes of the tree being built, the children are appended to it
+ * @param nodeIndex Index of the leaf node to split
+ * @param primitiveBounds Bounding box of every primitive
+ * @param centroids Centroid of every primitive's bounding box
+ * @param depth Depth of the node, used to respect the traversal stack size
+ * @param numThreads Number of threads to bin the centroids of large nodes with
+ * @return True if the node was split
+ */
+bool BVH::split(
+    std::vector<BVHNode>& nodes,
+    const uint32_t nodeIndex,
+    const std::vector<AABB>& primitiveBounds,
+    const std::vector<glm::vec3>& centroids,
+    const int depth,
+    unsigned int numThreads
+)
+{
+    const uint32_t first = nodes[nodeIndex].leftOrFirst;
+    const uint32_t count = nodes[nodeIndex].count;
+    if (count <= 1 || depth >= MAX_DEPTH - 1)
+    {
+        return false;
+    }
+
+    if (count < PARALLEL_BIN_SIZE)
+    {
+        numThreads = 1;
+    }
+
+    // Bins span the bounds of the centroids, so the extreme centroids land in the end bins
+    std::vector<AABB> chunkCentroidBounds(numThreads);
+    parallelChunks(first, count, numThreads,
+                   [&](const unsigned int chunk, const uint32_t begin, const uint32_t end) {
+                       for (uint32_t i = begin; i < end; i++)
+                       {
+                           chunkCentroidBounds[chunk].extend(
+                               centroids[m_primitiveIndices[i]]);
+                       }
+                   });
+
+    AABB centroidBounds;
+    for (const AABB& bounds: chunkCentroidBounds)
+    {
+        centroidBounds.extend(bounds);
+    }
+
+    const glm::vec3 centroidExtent = centroidBounds.extent();
+    glm::vec3 binScale(0.0f);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroidExtent[axis] > 0.0f)
+        {
+            binScale[axis] = static_cast<float>(NUM_BINS) / centroidExtent[axis];
+        }
+    }
+
+    auto binIndex = [&](const glm::vec3& centroid, const int axis) {
+        const auto bin = static_cast<int>((centroid[axis] - centroidBounds.min[axis]) *
+                                          binScale[axis]);
+        return std::min(bin, NUM_BINS - 1);
+    };
+
+    std::vector<Bins> chunkBins(numThreads);
+    parallelChunks(first, count, numThreads,
+                   [&](const unsigned int chunk, const uint32_t begin, const uint32_t end) {
+                       Bins& bins = chunkBins[chunk];
+                       for (uint32_t i = begin; i < end; i++)
+                       {
+                           const uint32_t primitive = m_primitiveIndices[i];
+                           for (int axis = 0; axis < 3; axis++)
+                           {
+                               const int bin = binIndex(centroids[primitive], axis);
+                               bins.bounds[axis][bin].extend(primitiveBounds[primitive]);
+                               bins.counts[axis][bin]++;
+                           }
+                       }
+                   });
+
+    Bins& bins = chunkBins[0];
+    for (unsigned int i = 1; i < numThreads; i++)
+    {
+        bins.merge(chunkBins[i]);
+    }
+
+    // Sweep over the boundaries between bins along each axis to find the cheapest split,
+    // where bins before bestBin go to the left child
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    int bestBin = 0;
+    AABB bestLeft, bestRight;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (centroidExtent[axis] <= 0.0f)
+        {
+            continue;
+        }
+
+        // rightBounds[i] and rightCounts[i] cover bins [i, NUM_BINS)
+        AABB rightBounds[NUM_BINS];
+        uint32_t rightCounts[NUM_BINS];
+        AABB right;
+        uint32_t rightCount = 0;
+        for (int i = NUM_BINS - 1; i > 0; i--)
+        {
+            right.extend(bins.bounds[axis][i]);
+            rightCount += bins.counts[axis][i];
+            rightBounds[i] = right;
+            rightCounts[i] = rightCount;
+        }
+
+        AABB left;
+        uint32_t leftCount = 0;
+        for (int i = 1; i < NUM_BINS; i++)
+        {
+            left.extend(bins.bounds[axis][i - 1]);
+            leftCount += bins.counts[axis][i - 1];
+            if (leftCount == 0 || rightCounts[i] == 0)
+            {
+                continue;
+            }
+
+            const float cost = left.surfaceArea() * intersectionCost(leftCount) +
+                               rightBounds[i].surfaceArea() * intersectionCost(rightCounts[i]);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = i;
+                bestLeft = left;
+                bestRight = rightBounds[i];
+            }
+        }
+    }
+
+    auto begin = m_primitiveIndices.begin() + first;
+    uint32_t leftCount;
+    if (bestAxis >= 0)
+    {
+        // Compare the expected cost of splitting against intersecting every primitive
+        const float parentArea = nodes[nodeIndex].bounds.surfaceArea();
+        const float leafCost = intersectionCost(count);
+        const float splitCost = (parentArea > 0.0f)
+                                    ? TRAVERSAL_COST + bestCost / parentArea
+                                    : leafCost;
+        if (splitCost >= leafCost && count <= MAX_LEAF_SIZE)
+        {
+            return false;
+        }
+
+        // Move the primitives of the left bins to the front of the node's range
+        auto middle = std::partition(
+            begin, begin + count,
+            [&](const uint32_t primitive) {
+                return binIndex(centroids[primitive], bestAxis) < bestBin;
+            });
+        leftCount = static_cast<uint32_t>(middle - begin);
+    }
+    else
+    {
+        // All centroids are at the same point, so only split to keep leaves small
+        if (count <= MAX_LEAF_SIZE)
+        {
+            return false;
+        }
+
+        leftCount = count / 2;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            AABB& bounds = (i < leftCount) ? bestLeft : bestRight;
+            bounds.extend(primitiveBounds[*(begin + i)]);
+        }
+    }
+
+    // Create the two children, stored next to each other
+    const auto leftIndex = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({bestLeft, first, leftCount});
+    nodes.push_back({bestRight, first + leftCount, count - leftCount});
+    nodes[nodeIndex].leftOrFirst = leftIndex;
+    nodes[nodeIndex].count = 0;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * subdivide recursively splits a leaf node until splitting no longer lowers the
+ * expected cost.
+ * @param nodes Nodes of the tree being built
+ * @param nodeIndex Index of the leaf node to subdivide
+ * @param primitiveBounds Bounding box of every primitive
+ * @param centroids Centroid of every primitive's bounding box
+ * @param depth Depth of the node, used to respect the traversal stack size
+ */
+void BVH::subdivide(
+    std::vector<BVHNode>& nodes,
+    const uint32_t nodeIndex,
+    const std::vector<AABB>& primitiveBounds,
+    const std::vector<glm::vec3>& centroids,
+    const int depth
+)
+{
+    if (!split(nodes, nodeIndex, primitiveBounds, centroids, depth, 1))
+    {
+        return;
+    }
+
+    const uint32_t leftIndex = nodes[nodeIndex].leftOrFirst;
+    subdivide(nodes, leftIndex, primitiveBounds, centroids, depth + 1);
+    subdivide(nodes, leftIndex + 1, primitiveBounds, centroids, depth + 1);
+}
@@ -0,0 +1,179 @@
+/*
+ * Name: BVH
+ * Description: Binary bounding volume hierarchy built with the binned surface area
+ * heuristic (SAH), optionally across several threads. The hierarchy only stores indices
+ * to primitives, so it can be used for any primitive that can be bounded by an AABB
+ * (e.g. the triangles of a mesh).
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "acceleration/AABB.hpp"
+
+/**
+ * BVHNode is a single node of the hierarchy. Interior nodes store the index of their
+ * left child, with the right child stored directly after it. Leaves store the range of
+ * primitive indices they contain.
+ */
+struct BVHNode {
+    AABB bounds;
+    uint32_t leftOrFirst; // Left child index (interior) or first primitive index (leaf)
+    uint32_t count;       // Number of primitives in a leaf, 0 for interior nodes
+
+    [[nodiscard]] bool isLeaf() const { return count > 0; }
+};
+
+/**
+ * BVH class builds and traverses a hierarchy over a set of primitive bounding boxes.
+ */
+class BVH {
+public:
+    // Maximum depth of the hierarchy, also the size of the traversal stack
+    static const int MAX_DEPTH = 64;
+
+    void build(
+        const std::vector<AABB>& primitiveBounds,
+        unsigned int numThreads = 1,
+        uint32_t leafBlockSize = 1
+    );
+
+    [[nodiscard]] bool isEmpty() const { return m_nodes.empty(); }
+    [[nodiscard]] const AABB& bounds() const { return m_nodes[0].bounds; }
+
+    template<typename IntersectPrimitive>
+    bool traverse(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float& tMax,
+        IntersectPrimitive&& intersectPrimitive
+    ) const;
+
+    std::vector<BVHNode> m_nodes;
+    std::vector<uint32_t> m_primitiveIndices;
+
+private:
+    [[nodiscard]] float intersectionCost(uint32_t count) const;
+    bool split(
+        std::vector<BVHNode>& nodes,
+        uint32_t nodeIndex,
+        const std::vector<AABB>& primitiveBounds,
+        const std::vector<glm::vec3>& centroids,
+        int depth,
+        unsigned int numThreads
+    );
+    void subdivide(
+        std::vector<BVHNode>& nodes,
+        uint32_t nodeIndex,
+        const std::vector<AABB>& primitiveBounds,
+        const std::vector<glm::vec3>& centroids,
+        int depth
+    );
+
+    uint32_t m_leafBlockSize = 1; // Number of primitives intersected together in a leaf
+};
+
+//---------------------------------------------------------------------------------------
+/**
+ * traverse walks the hierarchy front to back looking for the closest hit. Subtrees
+ * whose boxes start past the closest hit found so far are skipped.
+ * @param origin Ray origin in the space the hierarchy was built in
+ * @param direction Ray direction in the space the hierarchy was built in
+ * @param tMax Closest hit distance so far, shrunk as closer hits are found
+ * @param intersectPrimitive Callable as bool(uint32_t primitive, float& tMax) that tests
+ * a primitive and shrinks tMax when it finds a closer hit
+ * @return True if any primitive was hit before the initial tMax
+ */
+template<typename IntersectPrimitive>
+bool BVH::traverse(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float& tMax,
+    IntersectPrimitive&& intersectPrimitive
+) const
+{
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    const glm::vec3 invDir = 1.0f / direction;
+
+    float tNear;
+    if (!m_nodes[0].bounds.intersect(origin, invDir, tMax, tNear))
+    {
+        return false;
+    }
+
+    // Stack of nodes still to visit, with the distance at which the ray enters them
+    struct StackEntry {
+        uint32_t node;
+        float tNear;
+    };
+
+    bool hit = false;
+    StackEntry stack[MAX_DEPTH];
+    int stackSize = 0;
+    uint32_t nodeIndex = 0;
+    while (true)
+    {
+        const BVHNode& node = m_nodes[nodeIndex];
+        if (node.isLeaf())
+        {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+            {
+                hit |= intersectPrimitive(m_primitiveIndices[i], tMax);
+            }
+        }
+        else
+        {
+            // Visit the nearer child first, and push the other one if it is also hit
+            uint32_t near = node.leftOrFirst;
+            uint32_t far = node.leftOrFirst + 1;
+            float tNearA, tNearB;
+            const bool hitA = m_nodes[near].bounds.intersect(origin, invDir, tMax, tNearA);
+            const bool hitB = m_nodes[far].bounds.intersect(origin, invDir, tMax, tNearB);
+            if (hitA && hitB)
+            {
+                if (tNearB < tNearA)
+                {
+                    std::swap(near, far);
+                    std::swap(tNearA, tNearB);
+                }
+                stack[stackSize++] = {far, tNearB};
+                nodeIndex = near;
+                continue;
+            }
+            else if (hitA || hitB)
+            {
+                nodeIndex = hitA ? near : far;
+                continue;
+            }
+        }
+
+        // Pop the next node that may still contain a closer hit
+        bool found = false;
+        while (stackSize > 0)
+        {
+            const StackEntry& entry = stack[--stackSize];
+            if (entry.tNear <= tMax)
+            {
+                nodeIndex = entry.node;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            break;
+        }
+    }
+
+    return hit;
+}
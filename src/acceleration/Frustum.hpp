@@ -0,0 +1,53 @@
+/*
+ * Name: Frustum
+ * Description: Pyramid bounding a packet of rays that share an origin, such as the
+ * primary rays through a block of pixels. Hierarchies are culled against it once for the
+ * whole packet, instead of being traversed once for every ray.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "acceleration/AABB.hpp"
+
+/**
+ * Frustum struct defines the pyramid by its apex and the inward facing normals of its
+ * side planes, which all pass through the apex. It has no near or far plane.
+ */
+struct Frustum {
+    static const int NUM_PLANES = 4;
+
+    glm::vec3 origin;
+    glm::vec3 normals[NUM_PLANES];
+
+    // Build the pyramid from its apex and the directions of its edges, in order around it
+    Frustum(const glm::vec3& apex, const glm::vec3 (&edges)[NUM_PLANES])
+        : origin(apex)
+    {
+        const glm::vec3 center = edges[0] + edges[1] + edges[2] + edges[3];
+        for (int i = 0; i < NUM_PLANES; i++)
+        {
+            glm::vec3 normal = glm::cross(edges[i], edges[(i + 1) % NUM_PLANES]);
+            normals[i] = (glm::dot(normal, center) < 0.0f) ? -normal : normal;
+        }
+    }
+
+    // Whether the box may overlap the pyramid. Boxes near its edges may be kept even if
+    // they are outside, but boxes inside are never rejected
+    [[nodiscard]] bool overlaps(const AABB& box) const
+    {
+        for (const glm::vec3& normal: normals)
+        {
+            // The corner furthest along the normal is the last to leave the plane
+            const glm::vec3 corner(normal.x > 0.0f ? box.max.x : box.min.x,
+                                   normal.y > 0.0f ? box.max.y : box.min.y,
+                                   normal.z > 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(normal, corner - origin) < 0.0f)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
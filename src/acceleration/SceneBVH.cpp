@@ -0,0 +1,51 @@
+#include "SceneBVH.hpp"
+
+//---------------------------------------------------------------------------------------
+/**
+ * build constructs the hierarchy over the world space bounding boxes of the instances in
+ * snapshot, interpolating them within the shutter interval if any instance moves.
+ * @param snapshot Compiled scene for this frame
+ * @param numThreads Number of threads to build with
+ */
+void SceneBVH::build(const SceneSnapshot& snapshot, const unsigned int numThreads)
+{
+    m_snapshot = &snapshot;
+
+    std::vector<AABB> instanceBounds;
+    std::vector<AABB> closeBounds;
+    instanceBounds.reserve(snapshot.instances().size());
+    closeBounds.reserve(snapshot.instances().size());
+    for (const SceneInstance& instance: snapshot.instances())
+    {
+        instanceBounds.push_back(instance.bounds);
+        closeBounds.push_back(instance.closeBounds);
+    }
+
+    // Moving instances get boxes at both ends of the shutter interval
+    if (snapshot.hasMotion())
+    {
+        m_bvh.buildMotion(instanceBounds, closeBounds, numThreads);
+    }
+    else
+    {
+        m_bvh.build(instanceBounds, numThreads);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * cull finds the instances whose world space boxes overlap a frustum.
+ * @param frustum Frustum bounding a packet of rays, in world coordinates
+ * @param maxInstances Culling stops once more instances than this are found
+ * @param instanceIndices Set to the indices of the instances found in the snapshot
+ * @return False if there are more than maxInstances instances, or instances move while
+ * the shutter is open
+ */
+bool SceneBVH::cull(
+    const Frustum& frustum,
+    const size_t maxInstances,
+    std::vector<uint32_t>& instanceIndices
+) const
+{
+    return m_bvh.cull(frustum, maxInstances, instanceIndices);
+}
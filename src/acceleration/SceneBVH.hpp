@@ -0,0 +1,60 @@
+/*
+ * Name: SceneBVH
+ * Description: Top level bounding volume hierarchy over the instances of a scene
+ * snapshot. It is rebuilt every frame from the animated scene, with one leaf for every
+ * node that holds geometry, so rays skip whole parts of the scene they do not pass near.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "acceleration/Frustum.hpp"
+#include "acceleration/WideBVH.hpp"
+#include "core/Ray.hpp"
+#include "core/SceneSnapshot.hpp"
+
+/**
+ * SceneBVH class builds a hierarchy over the world space bounding boxes of the instances
+ * in a snapshot. The snapshot must outlive the hierarchy.
+ */
+class SceneBVH {
+public:
+    void build(const SceneSnapshot& snapshot, unsigned int numThreads = 1);
+    bool cull(
+        const Frustum& frustum,
+        size_t maxInstances,
+        std::vector<uint32_t>& instanceIndices
+    ) const;
+
+    template<typename IntersectInstance>
+    bool traverse(const Ray& ray, float& tMax, IntersectInstance&& intersectInstance) const;
+
+private:
+    const SceneSnapshot* m_snapshot = nullptr;
+    WideBVH m_bvh;
+};
+
+//---------------------------------------------------------------------------------------
+/**
+ * traverse walks the hierarchy with a world space ray, front to back.
+ * @param ray Ray in world coordinates
+ * @param tMax Parametric distance along the ray past which instances are skipped
+ * @param intersectInstance Callable as bool(uint32_t instanceIndex, float& tMax) that
+ * intersects an instance of the snapshot and shrinks tMax when it finds a closer hit,
+ * or sets it negative to end the walk
+ * @return True if intersectInstance reported a hit
+ */
+template<typename IntersectInstance>
+bool SceneBVH::traverse(
+    const Ray& ray,
+    float& tMax,
+    IntersectInstance&& intersectInstance
+) const
+{
+    return m_bvh.traverse(ray.origin(), ray.direction(), tMax, intersectInstance,
+                          m_snapshot->shutterFraction(ray.time()));
+}
@@ -0,0 +1,378 @@
+#include "WideBVH.hpp"
+
+//---------------------------------------------------------------------------------------
+/**
+ * setBounds stores the box of child i.
+ */
+void WideBVHNode::setBounds(const int i, const AABB& bounds)
+{
+    minX[i] = bounds.min.x;
+    minY[i] = bounds.min.y;
+    minZ[i] = bounds.min.z;
+    maxX[i] = bounds.max.x;
+    maxY[i] = bounds.max.y;
+    maxZ[i] = bounds.max.z;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * getBounds retrieves the box of child i.
+ */
+AABB WideBVHNode::getBounds(const int i) const
+{
+    return {glm::vec3(minX[i], minY[i], minZ[i]), glm::vec3(maxX[i], maxY[i], maxZ[i])};
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * interpolated linearly interpolates the boxes of the children between this node and
+ * the same node at the end of the shutter interval.
+ * @param close The node at the end of the shutter interval
+ * @param s Fraction of the shutter interval, from 0 (this node) to 1 (close)
+ * @return Node with the interpolated boxes
+ */
+WideBVHNode WideBVHNode::interpolated(const WideBVHNode& close, const float s) const
+{
+    WideBVHNode result = *this;
+    for (int i = 0; i < WIDTH; i++)
+    {
+        result.minX[i] += s * (close.minX[i] - minX[i]);
+        result.minY[i] += s * (close.minY[i] - minY[i]);
+        result.minZ[i] += s * (close.minZ[i] - minZ[i]);
+        result.maxX[i] += s * (close.maxX[i] - maxX[i]);
+        result.maxY[i] += s * (close.maxY[i] - maxY[i]);
+        result.maxZ[i] += s * (close.maxZ[i] - maxZ[i]);
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * build constructs the hierarchy over the given primitive bounding boxes by building a
+ * binary SAH hierarchy and collapsing it. Primitive i in the hierarchy refers to
+ * primitiveBounds[i].
+ * @param primitiveBounds Bounding box of every primitive
+ * @param numThreads Number of threads to build the binary hierarchy with
+ * @param leafBlockSize Number of primitives the caller intersects at once
+ */
+void WideBVH::build(
+    const std::vector<AABB>& primitiveBounds,
+    const unsigned int numThreads,
+    const uint32_t leafBlockSize
+)
+{
+    m_nodes.clear();
+    m_closeNodes.clear();
+    m_bounds = AABB();
+
+    BVH binary;
+    binary.build(primitiveBounds, numThreads, leafBlockSize);
+    m_primitiveIndices = binary.m_primitiveIndices;
+    if (binary.isEmpty())
+    {
+        return;
+    }
+
+    m_bounds = binary.bounds();
+    m_nodes.reserve(binary.m_nodes.size());
+
+    // A root that is a leaf still needs a node to hold its box
+    const BVHNode& root = binary.m_nodes[0];
+    if (root.isLeaf())
+    {
+        WideBVHNode node{};
+        node.numChildren = 1;
+        node.setBounds(0, root.bounds);
+        node.child[0] = root.leftOrFirst;
+        node.count[0] = root.count;
+        m_nodes.push_back(node);
+        return;
+    }
+
+    collapse(binary, 0);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * refit updates the boxes of the hierarchy after its primitives have moved, keeping the
+ * structure of the tree. This is much cheaper than a rebuild, but traversal slows down
+ * if primitives move far from where the hierarchy was built.
+ * @param primitiveBounds Bounding box of every primitive, in the order given to build
+ */
+void WideBVH::refit(const std::vector<AABB>& primitiveBounds)
+{
+    refit(primitiveBounds, m_primitiveIndices);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * refit updates the boxes of a hierarchy whose primitive indices are kept elsewhere, e.g.
+ * shared by the copies of a mesh made for each frame.
+ * @param primitiveBounds Bounding box of every primitive, in the order given to build
+ * @param primitiveIndices Primitive indices referenced by the leaves
+ */
+void WideBVH::refit(
+    const std::vector<AABB>& primitiveBounds,
+    const std::vector<uint32_t>& primitiveIndices
+)
+{
+    m_closeNodes.clear();
+    refitNodes(m_nodes, primitiveBounds, primitiveIndices);
+    updateBounds();
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * buildMotion constructs a hierarchy over primitives that move between the opening and
+ * closing of the camera shutter. The structure is built over the boxes swept by each
+ * primitive, and every node stores its children's boxes at both ends of the interval so
+ * traversal can interpolate them to the time of a ray.
+ * @param openBounds Bounding box of every primitive when the shutter opens
+ * @param closeBounds Bounding box of every primitive when the shutter closes
+ * @param numThreads Number of threads to build the binary hierarchy with
+ */
+void WideBVH::buildMotion(
+    const std::vector<AABB>& openBounds,
+    const std::vector<AABB>& closeBounds,
+    const unsigned int numThreads
+)
+{
+    std::vector<AABB> sweptBounds = openBounds;
+    for (size_t i = 0; i < sweptBounds.size(); i++)
+    {
+        sweptBounds[i].extend(closeBounds[i]);
+    }
+    build(sweptBounds, numThreads);
+
+    refitNodes(m_nodes, openBounds, m_primitiveIndices);
+    m_closeNodes = m_nodes;
+    refitNodes(m_closeNodes, closeBounds, m_primitiveIndices);
+    updateBounds();
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * refitNodes updates the boxes of nodes, which share the structure of the hierarchy.
+ * @param nodes Nodes to refit, either m_nodes or m_closeNodes
+ * @param primitiveBounds Bounding box of every primitive, in the order given to build
+ * @param primitiveIndices Primitive indices referenced by the leaves
+ */
+void WideBVH::refitNodes(
+    std::vector<WideBVHNode>& nodes,
+    const std::vector<AABB>& primitiveBounds,
+    const std::vector<uint32_t>& primitiveIndices
+)
+{
+    // Children always come after their parent, so walking backwards refits children first
+    for (auto nodeIndex = static_cast<uint32_t>(nodes.size()); nodeIndex-- > 0;)
+    {
+        WideBVHNode& node = nodes[nodeIndex];
+        for (uint32_t i = 0; i < node.numChildren; i++)
+        {
+            AABB bounds;
+            if (node.count[i] > 0)
+            {
+                for (uint32_t j = node.child[i]; j < node.child[i] + node.count[i]; j++)
+                {
+                    bounds.extend(primitiveBounds[primitiveIndices[j]]);
+                }
+            }
+            else
+            {
+                const WideBVHNode& child = nodes[node.child[i]];
+                for (uint32_t j = 0; j < child.numChildren; j++)
+                {
+                    bounds.extend(child.getBounds(j));
+                }
+            }
+            node.setBounds(i, bounds);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * restore replaces the hierarchy with one built earlier, e.g. loaded from a cache.
+ * @param nodes Nodes of the hierarchy, with the root first
+ * @param primitiveIndices Primitive indices referenced by the leaves
+ */
+void WideBVH::restore(std::vector<WideBVHNode> nodes, std::vector<uint32_t> primitiveIndices)
+{
+    m_nodes = std::move(nodes);
+    m_closeNodes.clear();
+    m_primitiveIndices = std::move(primitiveIndices);
+    updateBounds();
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * alignLeaves moves the primitives of every leaf to start at a multiple of
+ * WideBVHNode::WIDTH in m_primitiveIndices, so callers can store the primitives of a
+ * leaf in blocks of that size. The gaps are filled with PADDING_INDEX.
+ */
+void WideBVH::alignLeaves()
+{
+    std::vector<uint32_t> primitiveIndices;
+    primitiveIndices.reserve(m_primitiveIndices.size() + 2 * m_nodes.size());
+    for (size_t nodeIndex = 0; nodeIndex < m_nodes.size(); nodeIndex++)
+    {
+        WideBVHNode& node = m_nodes[nodeIndex];
+        for (uint32_t i = 0; i < node.numChildren; i++)
+        {
+            if (node.count[i] == 0)
+            {
+                continue;
+            }
+
+            const auto first = static_cast<uint32_t>(primitiveIndices.size());
+            primitiveIndices.insert(primitiveIndices.end(),
+                                    m_primitiveIndices.begin() + node.child[i],
+                                    m_primitiveIndices.begin() + node.child[i] + node.count[i]);
+            while (primitiveIndices.size() % WideBVHNode::WIDTH != 0)
+            {
+                primitiveIndices.push_back(PADDING_INDEX);
+            }
+
+            node.child[i] = first;
+            if (!m_closeNodes.empty())
+            {
+                m_closeNodes[nodeIndex].child[i] = first;
+            }
+        }
+    }
+    m_primitiveIndices = std::move(primitiveIndices);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * cull finds the primitives in the leaves whose boxes overlap a frustum, so a packet of
+ * rays inside the frustum only needs to be tested against those.
+ * @param frustum Frustum bounding a packet of rays
+ * @param maxPrimitives Culling stops once more primitives than this are found
+ * @param primitives Set to the indices of the primitives found
+ * @return False if there are more than maxPrimitives primitives, or the boxes move
+ * within the shutter interval
+ */
+bool WideBVH::cull(
+    const Frustum& frustum,
+    const size_t maxPrimitives,
+    std::vector<uint32_t>& primitives
+) const
+{
+    primitives.clear();
+    if (!m_closeNodes.empty())
+    {
+        return false;
+    }
+    if (m_nodes.empty())
+    {
+        return true;
+    }
+
+    uint32_t stack[BVH::MAX_DEPTH * (WideBVHNode::WIDTH - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const WideBVHNode& node = m_nodes[stack[--stackSize]];
+        int mask = node.intersectFrustum(frustum);
+        for (int i = 0; mask != 0; i++, mask >>= 1)
+        {
+            if (!(mask & 1))
+            {
+                continue;
+            }
+
+            if (node.count[i] == 0)
+            {
+                stack[stackSize++] = node.child[i];
+                continue;
+            }
+
+            if (primitives.size() + node.count[i] > maxPrimitives)
+            {
+                return false;
+            }
+            primitives.insert(primitives.end(),
+                              m_primitiveIndices.begin() + node.child[i],
+                              m_primitiveIndices.begin() + node.child[i] + node.count[i]);
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * updateBounds sets the bounds of the whole hierarchy from the children of the root,
+ * covering both ends of the shutter interval for moving hierarchies.
+ */
+void WideBVH::updateBounds()
+{
+    m_bounds = AABB();
+    for (const std::vector<WideBVHNode>* nodes: {&m_nodes, &m_closeNodes})
+    {
+        if (!nodes->empty())
+        {
+            for (uint32_t i = 0; i < (*nodes)[0].numChildren; i++)
+            {
+                m_bounds.extend((*nodes)[0].getBounds(i));
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * collapse creates a wide node for an interior node of the binary hierarchy. Its
+ * children are found by repeatedly opening the interior child with the largest surface
+ * area until the node is full, so nodes likely to be hit are skipped over.
+ * @param binary Binary hierarchy being collapsed
+ * @param binaryIndex Index of an interior node in binary
+ * @return Index of the new wide node
+ */
+uint32_t WideBVH::collapse(const BVH& binary, const uint32_t binaryIndex)
+{
+    const auto nodeIndex = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.emplace_back();
+
+    const BVHNode& binaryNode = binary.m_nodes[binaryIndex];
+    uint32_t children[WideBVHNode::WIDTH] = {binaryNode.leftOrFirst, binaryNode.leftOrFirst + 1};
+    int numChildren = 2;
+    while (numChildren < WideBVHNode::WIDTH)
+    {
+        int largest = -1;
+        float largestArea = -1.0f;
+        for (int i = 0; i < numChildren; i++)
+        {
+            const BVHNode& child = binary.m_nodes[children[i]];
+            if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea)
+            {
+                largest = i;
+                largestArea = child.bounds.surfaceArea();
+            }
+        }
+
+        if (largest < 0)
+        {
+            break;
+        }
+
+        const uint32_t opened = binary.m_nodes[children[largest]].leftOrFirst;
+        children[largest] = opened;
+        children[numChildren++] = opened + 1;
+    }
+
+    // Fill in the children, recursing into interior ones (which may grow m_nodes)
+    WideBVHNode node{};
+    node.numChildren = numChildren;
+    for (int i = 0; i < numChildren; i++)
+    {
+        const BVHNode& child = binary.m_nodes[children[i]];
+        node.setBounds(i, child.bounds);
+        node.count[i] = child.count;
+        node.child[i] = child.isLeaf() ? child.leftOrFirst : collapse(binary, children[i]);
+    }
+    m_nodes[nodeIndex] = node;
+
+    return nodeIndex;
+}
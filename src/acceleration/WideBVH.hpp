@@ -0,0 +1,351 @@
+/*
+ * Name: WideBVH
+ * Description: Four-wide bounding volume hierarchy built by collapsing a binary SAH
+ * hierarchy. The boxes of the four children of a node are stored as a structure of
+ * arrays so they can be tested against a ray at once with SSE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "acceleration/AABB.hpp"
+#include "acceleration/BVH.hpp"
+#include "acceleration/Frustum.hpp"
+
+/**
+ * WideBVHNode holds the boxes of up to WIDTH children. A child with a count of 0 is an
+ * interior node whose index is stored in child, otherwise it is a leaf covering count
+ * primitive indices starting at child. Children are packed at the front of the arrays.
+ */
+struct alignas(16) WideBVHNode {
+    static const int WIDTH = 4;
+
+    float minX[WIDTH], minY[WIDTH], minZ[WIDTH];
+    float maxX[WIDTH], maxY[WIDTH], maxZ[WIDTH];
+    uint32_t child[WIDTH];
+    uint32_t count[WIDTH];
+    uint32_t numChildren;
+
+    void setBounds(int i, const AABB& bounds);
+    [[nodiscard]] AABB getBounds(int i) const;
+    [[nodiscard]] WideBVHNode interpolated(const WideBVHNode& close, float s) const;
+
+    int intersect(
+        const glm::vec3& origin,
+        const glm::vec3& invDir,
+        float tMax,
+        float* tNear
+    ) const;
+    [[nodiscard]] int intersectFrustum(const Frustum& frustum) const;
+};
+
+/**
+ * WideBVH class builds and traverses a four-wide hierarchy over a set of primitive
+ * bounding boxes.
+ */
+class WideBVH {
+public:
+    // Entry of m_primitiveIndices that pads a leaf, see alignLeaves
+    static constexpr uint32_t PADDING_INDEX = 0xffffffff;
+
+    void build(
+        const std::vector<AABB>& primitiveBounds,
+        unsigned int numThreads = 1,
+        uint32_t leafBlockSize = 1
+    );
+    void buildMotion(
+        const std::vector<AABB>& openBounds,
+        const std::vector<AABB>& closeBounds,
+        unsigned int numThreads = 1
+    );
+    void refit(const std::vector<AABB>& primitiveBounds);
+    void refit(
+        const std::vector<AABB>& primitiveBounds,
+        const std::vector<uint32_t>& primitiveIndices
+    );
+    void restore(std::vector<WideBVHNode> nodes, std::vector<uint32_t> primitiveIndices);
+    void alignLeaves();
+
+    [[nodiscard]] bool isEmpty() const { return m_nodes.empty(); }
+    [[nodiscard]] const AABB& bounds() const { return m_bounds; }
+
+    template<typename IntersectPrimitive>
+    bool traverse(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float& tMax,
+        IntersectPrimitive&& intersectPrimitive,
+        float shutterTime = 0.0f
+    ) const;
+
+    bool cull(
+        const Frustum& frustum,
+        size_t maxPrimitives,
+        std::vector<uint32_t>& primitives
+    ) const;
+
+    template<typename IntersectLeaf>
+    bool traverseLeaves(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float& tMax,
+        IntersectLeaf&& intersectLeaf,
+        float shutterTime = 0.0f
+    ) const;
+
+    std::vector<WideBVHNode> m_nodes;
+    std::vector<uint32_t> m_primitiveIndices;
+
+private:
+    uint32_t collapse(const BVH& binary, uint32_t binaryIndex);
+    static void refitNodes(
+        std::vector<WideBVHNode>& nodes,
+        const std::vector<AABB>& primitiveBounds,
+        const std::vector<uint32_t>& primitiveIndices
+    );
+    void updateBounds();
+
+    std::vector<WideBVHNode> m_closeNodes; // m_nodes at shutter close, empty if static
+    AABB m_bounds;
+};
+
+//---------------------------------------------------------------------------------------
+/**
+ * intersect tests the ray against the boxes of all children at once.
+ * @param origin Ray origin
+ * @param invDir Component-wise reciprocal of the ray direction
+ * @param tMax Only boxes entered before tMax are reported
+ * @param tNear Set to the parametric distance at which the ray enters each child box
+ * @return Bit mask with bit i set if child i is hit
+ */
+inline int WideBVHNode::intersect(
+    const glm::vec3& origin,
+    const glm::vec3& invDir,
+    const float tMax,
+    float* tNear
+) const
+{
+    const int validMask = (1 << numChildren) - 1;
+
+#if defined(__SSE2__)
+    const __m128 ox = _mm_set1_ps(origin.x);
+    const __m128 oy = _mm_set1_ps(origin.y);
+    const __m128 oz = _mm_set1_ps(origin.z);
+    const __m128 ix = _mm_set1_ps(invDir.x);
+    const __m128 iy = _mm_set1_ps(invDir.y);
+    const __m128 iz = _mm_set1_ps(invDir.z);
+
+    const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minX), ox), ix);
+    const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxX), ox), ix);
+    const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minY), oy), iy);
+    const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxY), oy), iy);
+    const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(minZ), oz), iz);
+    const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxZ), oz), iz);
+
+    const __m128 tEntry = _mm_max_ps(
+        _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)),
+        _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+    const __m128 tExit = _mm_min_ps(
+        _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)),
+        _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(tMax)));
+
+    _mm_storeu_ps(tNear, tEntry);
+    return _mm_movemask_ps(_mm_cmple_ps(tEntry, tExit)) & validMask;
+#else
+    int mask = 0;
+    for (int i = 0; i < static_cast<int>(numChildren); i++)
+    {
+        if (getBounds(i).intersect(origin, invDir, tMax, tNear[i]))
+        {
+            mask |= (1 << i);
+        }
+    }
+    return mask & validMask;
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * intersectFrustum tests the boxes of all children against a frustum at once.
+ * @param frustum Frustum bounding a packet of rays
+ * @return Bit mask with bit i set if child i may overlap the frustum
+ */
+inline int WideBVHNode::intersectFrustum(const Frustum& frustum) const
+{
+    const int validMask = (1 << numChildren) - 1;
+
+#if defined(__SSE2__)
+    const __m128 ox = _mm_set1_ps(frustum.origin.x);
+    const __m128 oy = _mm_set1_ps(frustum.origin.y);
+    const __m128 oz = _mm_set1_ps(frustum.origin.z);
+    const __m128 zero = _mm_setzero_ps();
+
+    // A box is outside if its corner furthest along the normal of a plane is behind it
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (const glm::vec3& normal: frustum.normals)
+    {
+        const __m128 cx = _mm_sub_ps(_mm_load_ps(normal.x > 0.0f ? maxX : minX), ox);
+        const __m128 cy = _mm_sub_ps(_mm_load_ps(normal.y > 0.0f ? maxY : minY), oy);
+        const __m128 cz = _mm_sub_ps(_mm_load_ps(normal.z > 0.0f ? maxZ : minZ), oz);
+        const __m128 distance = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(normal.x)),
+                       _mm_mul_ps(cy, _mm_set1_ps(normal.y))),
+            _mm_mul_ps(cz, _mm_set1_ps(normal.z)));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+    }
+    return _mm_movemask_ps(inside) & validMask;
+#else
+    int mask = 0;
+    for (int i = 0; i < static_cast<int>(numChildren); i++)
+    {
+        if (frustum.overlaps(getBounds(i)))
+        {
+            mask |= (1 << i);
+        }
+    }
+    return mask;
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * traverse walks the hierarchy front to back looking for the closest hit. Subtrees
+ * whose boxes start past the closest hit found so far are skipped, and the walk ends as
+ * soon as intersectPrimitive sets tMax negative, which occlusion queries do on any hit.
+ * @param origin Ray origin in the space the hierarchy was built in
+ * @param direction Ray direction in the space the hierarchy was built in
+ * @param tMax Closest hit distance so far, shrunk as closer hits are found
+ * @param intersectPrimitive Callable as bool(uint32_t primitive, float& tMax) that tests
+ * a primitive and shrinks tMax when it finds a closer hit
+ * @param shutterTime Fraction of the shutter interval the ray is traced at, used to
+ * interpolate the boxes of hierarchies built with buildMotion
+ * @return True if any primitive was hit before the initial tMax
+ */
+template<typename IntersectPrimitive>
+bool WideBVH::traverse(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float& tMax,
+    IntersectPrimitive&& intersectPrimitive,
+    const float shutterTime
+) const
+{
+    return traverseLeaves(
+        origin, direction, tMax,
+        [&](const uint32_t first, const uint32_t count, float& tMaxLeaf) {
+            bool hit = false;
+            for (uint32_t i = first; i < first + count; i++)
+            {
+                hit |= intersectPrimitive(m_primitiveIndices[i], tMaxLeaf);
+                if (tMaxLeaf < 0.0f)
+                {
+                    break;
+                }
+            }
+            return hit;
+        },
+        shutterTime);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * traverseLeaves walks the hierarchy like traverse, but hands whole leaves to the
+ * caller so it can test their primitives together. Setting tMax negative ends the walk.
+ * @param origin Ray origin in the space the hierarchy was built in
+ * @param direction Ray direction in the space the hierarchy was built in
+ * @param tMax Closest hit distance so far, shrunk as closer hits are found
+ * @param intersectLeaf Callable as bool(uint32_t first, uint32_t count, float& tMax) that
+ * tests the count primitives from m_primitiveIndices[first] and shrinks tMax when it
+ * finds a closer hit
+ * @param shutterTime Fraction of the shutter interval the ray is traced at, used to
+ * interpolate the boxes of hierarchies built with buildMotion
+ * @return True if any primitive was hit before the initial tMax
+ */
+template<typename IntersectLeaf>
+bool WideBVH::traverseLeaves(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float& tMax,
+    IntersectLeaf&& intersectLeaf,
+    const float shutterTime
+) const
+{
+    if (m_nodes.empty())
+    {
+        return false;
+    }
+
+    // Children still to visit, either a node (count of 0) or a leaf's primitives
+    struct StackEntry {
+        uint32_t index;
+        uint32_t count;
+        float tNear;
+    };
+
+    const glm::vec3 invDir = 1.0f / direction;
+
+    bool hit = false;
+    StackEntry stack[BVH::MAX_DEPTH * (WideBVHNode::WIDTH - 1) + 1];
+    int stackSize = 0;
+    stack[stackSize++] = {0, 0, 0.0f};
+    while (stackSize > 0)
+    {
+        const StackEntry entry = stack[--stackSize];
+        if (entry.tNear > tMax)
+        {
+            continue;
+        }
+
+        if (entry.count > 0)
+        {
+            hit |= intersectLeaf(entry.index, entry.count, tMax);
+            if (tMax < 0.0f)
+            {
+                break;
+            }
+            continue;
+        }
+
+        const WideBVHNode& node = m_nodes[entry.index];
+        float tNear[WideBVHNode::WIDTH];
+        int mask = m_closeNodes.empty()
+                       ? node.intersect(origin, invDir, tMax, tNear)
+                       : node.interpolated(m_closeNodes[entry.index], shutterTime)
+                             .intersect(origin, invDir, tMax, tNear);
+
+        // Sort the children that were hit from far to near, so the nearest is popped first
+        int order[WideBVHNode::WIDTH];
+        int numHits = 0;
+        for (int i = 0; mask != 0; i++, mask >>= 1)
+        {
+            if (!(mask & 1))
+            {
+                continue;
+            }
+
+            int j = numHits++;
+            while (j > 0 && tNear[order[j - 1]] < tNear[i])
+            {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+
+        for (int k = 0; k < numHits; k++)
+        {
+            const int i = order[k];
+            stack[stackSize++] = {node.child[i], node.count[i], tNear[i]};
+        }
+    }
+
+    return hit;
+}
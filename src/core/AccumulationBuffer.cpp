@@ -0,0 +1,63 @@
+#include "AccumulationBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+//---------------------------------------------------------------------------------------
+AccumulationBuffer::AccumulationBuffer(const uint width, const uint height)
+    : m_width(width),
+      m_height(height),
+      m_sums(width * height, Color(0.0f)),
+      m_clampedSums(width * height, Color(0.0f)),
+      m_clampedSquares(width * height, Color(0.0f))
+{}
+
+//---------------------------------------------------------------------------------------
+// Add a sample to the pixel (x, y)
+void AccumulationBuffer::add(const uint x, const uint y, const Color& sample)
+{
+    const size_t pixel = x * m_height + y;
+    const Color clamped = glm::clamp(sample, 0.0f, 1.0f);
+    m_sums[pixel] += sample;
+    m_clampedSums[pixel] += clamped;
+    m_clampedSquares[pixel] += clamped * clamped;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * noise estimates how far the image is from the converged image, as the root mean square
+ * over the pixels of the standard error of their mean colour, taking the largest error of
+ * the channels of each pixel.
+ * @param numPasses Number of samples added to every pixel, at least 2
+ * @return Estimated error, in the units of the image
+ */
+float AccumulationBuffer::noise(const int numPasses) const
+{
+    const float n = static_cast<float>(numPasses);
+    double sum = 0.0;
+    for (size_t pixel = 0; pixel < m_sums.size(); pixel++)
+    {
+        const Color mean = m_clampedSums[pixel] / n;
+        const Color variance = (m_clampedSquares[pixel] - mean * m_clampedSums[pixel]) /
+                               (n - 1.0f);
+        const Color squaredError = glm::max(variance, 0.0f) / n;
+        sum += std::max({squaredError.r, squaredError.g, squaredError.b});
+    }
+    return static_cast<float>(std::sqrt(sum / static_cast<double>(m_sums.size())));
+}
+
+//---------------------------------------------------------------------------------------
+// Write the mean of the samples of every pixel to the image, which is the same size
+void AccumulationBuffer::resolve(Image& image, const int numPasses) const
+{
+    for (uint x = 0; x < m_width; x++)
+    {
+        for (uint y = 0; y < m_height; y++)
+        {
+            const Color color = m_sums[x * m_height + y] / static_cast<float>(numPasses);
+            image(x, y, 0) = (double) color.r;
+            image(x, y, 1) = (double) color.g;
+            image(x, y, 2) = (double) color.b;
+        }
+    }
+}
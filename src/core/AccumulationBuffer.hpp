@@ -0,0 +1,35 @@
+/*
+ * Name: AccumulationBuffer
+ * Description: Float buffer that progressive rendering adds one sample of every pixel to
+ * per pass. It can be written out to an image at any time, and estimates how much noise
+ * is left in the image so rendering can stop once it is clean enough.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "utils/Image.hpp"
+
+/**
+ * AccumulationBuffer class keeps the sum of the samples of every pixel, and the sums of
+ * the samples and their squares clamped to what an image can show, to estimate the
+ * variance of the pixels. Different threads may add to different pixels at once.
+ */
+class AccumulationBuffer {
+public:
+    AccumulationBuffer(uint width, uint height);
+
+    void add(uint x, uint y, const Color& sample);
+    [[nodiscard]] float noise(int numPasses) const;
+    void resolve(Image& image, int numPasses) const;
+
+private:
+    uint m_width;
+    uint m_height;
+    std::vector<Color> m_sums;
+    std::vector<Color> m_clampedSums;
+    std::vector<Color> m_clampedSquares;
+};
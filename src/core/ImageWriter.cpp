@@ -0,0 +1,123 @@
+#include "ImageWriter.hpp"
+
+#include <algorithm>
+
+//---------------------------------------------------------------------------------------
+/**
+ * Constructor for ImageWriter, starts the threads writing images.
+ * @param numThreads Number of threads, at least 1
+ * @param maxQueuedBytes Memory the images waiting to be written may take. A single image
+ * larger than this is still written, one at a time
+ */
+ImageWriter::ImageWriter(const unsigned int numThreads, const size_t maxQueuedBytes)
+    : m_maxQueuedBytes(maxQueuedBytes)
+{
+    for (unsigned int i = 0; i < std::max(1u, numThreads); i++)
+    {
+        m_threads.emplace_back(&ImageWriter::workerLoop, this);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Writes the images still queued, then stops the threads
+ImageWriter::~ImageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_jobAdded.notify_all();
+    for (std::thread& thread: m_threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * write queues an image to be written, waiting first for earlier images to be written if
+ * the queue would take too much memory with it.
+ * @param image Image to write, which the writer owns from here on
+ * @param path PNG file to write it to
+ */
+void ImageWriter::write(Image image, const std::string& path)
+{
+    const size_t bytes = imageBytes(image);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobDone.wait(lock, [&]() {
+        return m_queuedBytes == 0 || m_queuedBytes + bytes <= m_maxQueuedBytes;
+    });
+    m_jobs.push_back({std::move(image), path});
+    m_queuedBytes += bytes;
+    lock.unlock();
+    m_jobAdded.notify_all();
+}
+
+//---------------------------------------------------------------------------------------
+// Wait for every image handed over so far to be written
+void ImageWriter::finish()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobDone.wait(lock, [&]() { return m_jobs.empty() && m_writing.empty(); });
+}
+
+//---------------------------------------------------------------------------------------
+// Takes the outcomes of the images written since the last call, in the order they were
+// written
+std::vector<WrittenImage> ImageWriter::takeWritten()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<WrittenImage> written;
+    written.swap(m_written);
+    return written;
+}
+
+//---------------------------------------------------------------------------------------
+// Writes the oldest queued image whose path is not being written already, until the
+// writer stops with nothing left to write
+void ImageWriter::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        const auto isFree = [&](const Job& queued) {
+            return m_writing.count(queued.path) == 0;
+        };
+        const auto job = std::find_if(m_jobs.begin(), m_jobs.end(), isFree);
+        if (job == m_jobs.end())
+        {
+            if (m_stopping && m_jobs.empty())
+            {
+                return;
+            }
+            m_jobAdded.wait(lock);
+            continue;
+        }
+
+        Job taken = std::move(*job);
+        m_jobs.erase(job);
+        m_writing.insert(taken.path);
+        lock.unlock();
+
+        const auto writeStart = std::chrono::steady_clock::now();
+        const bool written = taken.image.savePng(taken.path);
+        const std::chrono::duration<double, std::milli> writeTime =
+            std::chrono::steady_clock::now() - writeStart;
+
+        lock.lock();
+        m_writing.erase(taken.path);
+        m_queuedBytes -= imageBytes(taken.image);
+        m_written.push_back({taken.path, written, writeTime});
+        m_jobDone.notify_all();
+
+        // Another image with the same path may be waiting on this one
+        m_jobAdded.notify_all();
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Memory taken by the pixels of an image
+size_t ImageWriter::imageBytes(const Image& image)
+{
+    return static_cast<size_t>(image.width()) * image.height() * 3 * sizeof(double);
+}
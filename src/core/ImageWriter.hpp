@@ -0,0 +1,76 @@
+/*
+ * Name: ImageWriter
+ * Description: Encodes and writes PNG images on background threads, so rendering moves on
+ * to the next frame while the last one is written. Images are handed over as owned
+ * copies, and the queue of images waiting to be written is bounded by the memory they
+ * take, past which handing over another image waits for a write to finish. Images with
+ * the same path are written in the order they were handed over.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/Image.hpp"
+
+// Threads encoding images at once, encoding is single threaded
+const unsigned int WRITER_THREADS = 2;
+
+// Memory the images waiting to be written may take, before handing over more waits
+const size_t WRITER_QUEUE_BYTES = size_t(256) << 20;
+
+/**
+ * WrittenImage is the outcome of writing an image.
+ */
+struct WrittenImage {
+    std::string path;
+    bool written; // Whether the image was encoded and written
+    std::chrono::duration<double, std::milli> writeTime;
+};
+
+/**
+ * ImageWriter writes images on a set of threads that live as long as the writer.
+ */
+class ImageWriter {
+public:
+    explicit ImageWriter(
+        unsigned int numThreads = WRITER_THREADS,
+        size_t maxQueuedBytes = WRITER_QUEUE_BYTES
+    );
+    ~ImageWriter();
+
+    ImageWriter(const ImageWriter&) = delete;
+    ImageWriter& operator=(const ImageWriter&) = delete;
+
+    void write(Image image, const std::string& path);
+    void finish();
+    std::vector<WrittenImage> takeWritten();
+
+private:
+    struct Job {
+        Image image;
+        std::string path;
+    };
+
+    void workerLoop();
+    static size_t imageBytes(const Image& image);
+
+    std::vector<std::thread> m_threads;
+    size_t m_maxQueuedBytes;
+
+    std::mutex m_mutex; // Guards everything below
+    std::condition_variable m_jobAdded;
+    std::condition_variable m_jobDone;
+    std::deque<Job> m_jobs;
+    std::set<std::string> m_writing; // Paths being written
+    size_t m_queuedBytes = 0;       // Memory of the images queued or being written
+    std::vector<WrittenImage> m_written;
+    bool m_stopping = false;
+};
@@ -1,16 +1,48 @@
+#include <algorithm>
 #include <iostream>
+#include <map>
 
+#include "core/RenderJob.hpp"
 #include "utils/scene_lua.hpp"
 
 int main(int argc, char** argv)
 {
     std::string filename = "simple.lua";
-    if (argc >= 2)
+    int arg = 1;
+    if (argc >= 2 && std::string(argv[1]).rfind("--", 0) != 0)
     {
         filename = argv[1];
+        arg++;
     }
 
-    if (!run_lua(filename))
+    // Every other argument is a render setting, given as --name value
+    std::map<std::string, std::string> settings;
+    for (; arg < argc; arg += 2)
+    {
+        std::string name = argv[arg];
+        if (name.rfind("--", 0) != 0 || arg + 1 >= argc)
+        {
+            std::cerr << "Usage: " << argv[0] << " <scene.lua> [--samples N]"
+                      << " [--min-samples N] [--max-samples N] [--threshold X]"
+                      << " [--budget seconds] [--noise X] [--checkpoint seconds]"
+                      << " [--depth N] [--threads N] [--tile-size N] [--seed N]"
+                      << " [--output path] [--logs true|false] [--frames first:last]"
+                      << " [--shard index/count] [--workers N] [--report path]"
+                      << " [--serve address] [--connect address,...]"
+                      << std::endl;
+            return 1;
+        }
+
+        // Settings are named like the fields of the table passed to gr.render
+        name = name.substr(2);
+        std::replace(name.begin(), name.end(), '-', '_');
+        settings[name] = argv[arg + 1];
+    }
+
+    // Worker processes of a render job rerun this command line for a single frame
+    setWorkerCommand(argc, argv);
+
+    if (!run_lua(filename, settings))
     {
         std::cerr << "Could not open " << filename <<
                 ". Try running the executable from inside of" <<
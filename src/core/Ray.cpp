@@ -48,6 +48,15 @@ void Ray::transform(const glm::mat4& T)
     m_modelDirection = glm::vec3(T * glm::vec4(m_direction, 0.0f));
 }
 
+//---------------------------------------------------------------------------------------
+// Transforms the model origin and direction further by the affine T, e.g. into the model
+// coordinates of an instance placed within the model
+void Ray::transformModel(const glm::mat4x3& T)
+{
+    m_modelOrigin = T * glm::vec4(m_modelOrigin, 1.0f);
+    m_modelDirection = T * glm::vec4(m_modelDirection, 0.0f);
+}
+
 //---------------------------------------------------------------------------------------
 std::ostream& operator<<(std::ostream& os, const Ray& ray)
 {
@@ -58,27 +67,9 @@ std::ostream& operator<<(std::ostream& os, const Ray& ray)
 }
 
 //---------------------------------------------------------------------------------------
-// Checks if newPoint is closer than an existing intersection in m_point from ray origin
-// Returns true if newPoint is closer, false otherwise
-bool Intersection::isPointCloser(const glm::vec3& newPoint, const Ray& ray) const
-{
-    // If there is no intersection yet then this point is closer by default
-    // In the case of a light sources, we check with m_point (which stores light pos)
-    if (!m_foundIntersection && !m_isLight)
-    {
-        return true;
-    }
-
-    // Check distances and return true if newPoint is closer (in world coordinates)
-    float d_new = glm::length(newPoint - ray.origin());
-    float d_prev = glm::length(m_point - ray.origin());
-    return (d_new < d_prev);
-}
-
-//---------------------------------------------------------------------------------------
-// Transforms the intersection point and normal by T
-void Intersection::transformIntersection(const glm::mat4& T)
+// Transforms the intersection point by T and normal by normalT (the inverse transpose)
+void Intersection::transformIntersection(const glm::mat4& T, const glm::mat3& normalT)
 {
-    m_normal = glm::normalize(glm::mat3(glm::transpose(glm::inverse(T))) * m_normal);
+    m_normal = glm::normalize(normalT * m_normal);
     m_point = glm::vec3(T * glm::vec4(m_point, 1.0f));
 }
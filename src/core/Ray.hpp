@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 
 #include <glm/glm.hpp>
@@ -16,6 +17,7 @@ public:
     glm::vec3 transformedDirection() const;
     float time() const;
     void transform(const glm::mat4& T);
+    void transformModel(const glm::mat4x3& T);
 
     friend std::ostream& operator<<(std::ostream& os, const Ray& ray);
 
@@ -31,18 +33,29 @@ private:
     float m_time;
 };
 
+/**
+ * Hit is the closest hit found while a ray is traced through the scene. It holds only
+ * what is needed to find the hit again, so the point, normal, uv and material are
+ * computed once for the closest hit rather than for every surface the ray passes.
+ */
+struct Hit {
+    float t;            // Parametric distance along the ray, the same in every space
+    uint32_t instance;  // Instance of the scene snapshot that was hit
+    uint32_t copy;      // Copy of the primitive within an instance node, or particle
+    uint32_t primitive; // Face of a mesh or box
+    glm::vec2 barycentric; // Coordinates of the hit along the edges of the face
+};
+
 class Intersection {
 public:
     Intersection()
-        : m_isLight(false),
-          m_foundIntersection(false)
+        : m_foundIntersection(false)
     {};
 
-    bool isPointCloser(const glm::vec3& newPoint, const Ray& ray) const;
-    void transformIntersection(const glm::mat4& T);
+    void transformIntersection(const glm::mat4& T, const glm::mat3& normalT);
 
     bool m_foundIntersection;
-    bool m_isLight;
+    float m_t; // Parametric distance along the ray, before the point is offset
     glm::vec3 m_point;
     glm::vec2 m_uv;
     glm::vec3 m_normal;
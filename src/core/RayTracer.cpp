@@ -1,12 +1,28 @@
 #include "RayTracer.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iomanip>
+#include <memory>
 #include <sstream>
-#include <thread>
 #include <vector>
 
 #include <glm/ext.hpp>
 
+#include "core/ImageWriter.hpp"
+#include "core/RenderJob.hpp"
+#include "core/Threads.hpp"
+#include "core/TileNetwork.hpp"
+
+// Distance intersection points are pushed off the surface along the normal
+const float HIT_OFFSET = 0.25f;
+
+// Packets whose frustum overlaps more instances than this have diverged too much to share
+// a traversal, and their rays are traced on their own
+const size_t MAX_PACKET_INSTANCES = 32;
+
 //---------------------------------------------------------------------------------------
 RayTracer::RayTracer(
     SceneNode* root,
@@ -14,114 +30,181 @@ RayTracer::RayTracer(
     const glm::vec3& eye,
     const glm::vec3& ambient,
     const std::list<Light*>& lights,
-    Image* image)
+    Image* image,
+    const float shutter,
+    const RenderSettings& settings)
     : m_root(root),
       m_screenToWorld(screenToWorld),
       m_eye(eye),
       m_ambient(ambient),
       m_lights(lights),
-      m_image(image)
+      m_image(image),
+      m_shutter(shutter),
+      m_settings(settings)
 {}
 
 //---------------------------------------------------------------------------------------
-// Traverses the scene graph and adds all animations
-void RayTracer::preprocessAnimation(SceneNode* node, const float t)
+// Flattens the scene graph into a snapshot of this frame, with the animations of the
+// nodes, lights and geometry evaluated for openTime, and builds the top level hierarchy
+// over it. If the shutter stays open, the snapshot also records where every instance
+// ends up at closeTime. The scene graph is only read, so the snapshots of several frames
+// can be compiled and traced at once
+void RayTracer::compileScene(const float openTime, const float closeTime)
 {
-    node->animateNode(t);
+    m_snapshot.compile(m_root, m_lights, openTime, closeTime);
+    m_sceneBVH.build(m_snapshot, m_settings.threads);
+}
 
-    for (SceneNode* child: node->children)
+//---------------------------------------------------------------------------------------
+// Walks the top level hierarchy for an intersection with ray (in world coordinates)
+// Sets intersection to the closest intersection if there is one
+void RayTracer::intersectScene(const Ray& ray, Intersection& intersection) const
+{
+    Hit hit{};
+    float tMax = std::numeric_limits<float>::max();
+    auto intersect = [&](const uint32_t instanceIndex, float& tMaxInstance) {
+        return intersectInstance(ray, instanceIndex, hit, tMaxInstance);
+    };
+
+    if (m_sceneBVH.traverse(ray, tMax, intersect))
     {
-        preprocessAnimation(child, t);
+        finalizeHit(ray, hit, intersection);
     }
 }
 
 //---------------------------------------------------------------------------------------
-// Traverses the scene graph and resets all animations
-void RayTracer::resetAnimation(SceneNode* node)
+// Transforms ray (in world coordinates) into the model coordinates of an instance, placed
+// where it is at the time of the ray if it moves
+Ray RayTracer::modelRay(const Ray& ray, const SceneInstance& instance) const
 {
-    node->resetAnimation();
-
-    for (SceneNode* child: node->children)
+    Ray result = ray;
+    if (instance.moving)
+    {
+        result.transform(instance.invTransAt(m_snapshot.shutterFraction(ray.time())));
+    }
+    else
     {
-        resetAnimation(child);
+        result.transform(instance.invTrans);
     }
+    return result;
 }
 
 //---------------------------------------------------------------------------------------
-// Traverses the hierarchial scene graph starting at node for an intersection with ray
-// Modifies intersection to the closest intersection if there is one
-// trans and invTrans are used to pass hierarchial transformations down the tree
-void RayTracer::traverseSceneGraph(
-    const SceneNode* node,
-    Ray ray,
-    Intersection& intersection,
-    glm::mat4 trans,
-    glm::mat4 invTrans
+// Checks ray (in world coordinates) against a single instance of the scene
+// Modifies hit and tMax if the instance is hit before tMax. The parametric distance is
+// the same in model coordinates, so hits on different instances are compared with it
+bool RayTracer::intersectInstance(
+    const Ray& ray,
+    const uint32_t instanceIndex,
+    Hit& hit,
+    float& tMax
 ) const
 {
-    // Add transformations of the current node as we go "down" the tree
-    trans = trans * node->get_transform();
-    invTrans = node->get_inverse() * invTrans;
-
-    // Transform the ray into model coordinates of this node
-    ray.transform(invTrans);
-
-    // Find intersection with this node and check if closer than an existing intersection
-    Intersection temp = node->intersect(ray);
-    temp.transformIntersection(trans); // Intersection converted to world coords
-    temp.m_point += 0.25f * temp.m_normal; // Add fudge factor
-    if (temp.m_foundIntersection && intersection.isPointCloser(temp.m_point, ray))
+    const SceneInstance& instance = m_snapshot.instances()[instanceIndex];
+    if (!instance.node->closestHit(modelRay(ray, instance), tMax, hit))
     {
-        intersection = temp;
+        return false;
     }
 
-    // Recursively check for more intersections with children nodes
-    for (const SceneNode* child: node->children)
+    hit.instance = instanceIndex;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the surface at the closest hit of ray (in world coordinates) into intersection
+// Only done once per ray, for the hit that is kept
+void RayTracer::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+    // Moving instances are placed where they are at the time of the ray
+    const SceneInstance& instance = m_snapshot.instances()[hit.instance];
+    glm::mat4 trans = instance.trans;
+    glm::mat4 invTrans = instance.invTrans;
+    glm::mat3 normalTrans = instance.normalTrans;
+    if (instance.moving)
     {
-        traverseSceneGraph(child, ray, intersection, trans, invTrans);
+        instance.transformsAt(m_snapshot.shutterFraction(ray.time()),
+                              trans, invTrans, normalTrans);
     }
+
+    Ray model = ray;
+    model.transform(invTrans);
+    instance.node->finalizeHit(model, hit, intersection);
+
+    // Intersection converted to world coords
+    intersection.transformIntersection(trans, normalTrans);
+    intersection.m_point += HIT_OFFSET * intersection.m_normal; // Add fudge factor
+    intersection.m_t = hit.t;
+    intersection.m_foundIntersection = true;
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if anything in the scene blocks ray (in world coordinates) before the parametric
+// distance tMax. Stops at the first blocker instead of looking for the closest one
+bool RayTracer::occluded(const Ray& ray, float tMax) const
+{
+    auto occludedInstance = [&](const uint32_t instanceIndex, float& tMaxInstance) {
+        const SceneInstance& instance = m_snapshot.instances()[instanceIndex];
+        if (!instance.node->occluded(modelRay(ray, instance), tMaxInstance))
+        {
+            return false;
+        }
+        tMaxInstance = -1.0f; // Any hit will do, end the walk
+        return true;
+    };
+
+    return m_sceneBVH.traverse(ray, tMax, occludedInstance);
 }
 
 //---------------------------------------------------------------------------------------
 // Trace the path of a ray and get a colour for it
 Color RayTracer::raytrace(Ray& ray, const int currDepth) const
 {
-    // Default background gradient
-    float blend = 0.5f * (glm::normalize(ray.direction()).y + 1.0f);
-    glm::vec3 color = (1.0f - blend) * glm::vec3(1.0f, 0.235f, 0.976f)
-                      + blend * glm::vec3(0.224f, 0.996f, 1.0f);
-
     // Get closest intersection to an object
     Intersection intersection;
-    traverseSceneGraph(m_root, ray, intersection, glm::mat4(), glm::mat4());
+    intersectScene(ray, intersection);
+
+    return shade(ray, intersection, currDepth);
+}
+
+//---------------------------------------------------------------------------------------
+// Default background gradient, seen by rays that do not hit anything
+Color RayTracer::background(const Ray& ray) const
+{
+    float blend = 0.5f * (glm::normalize(ray.direction()).y + 1.0f);
+    return (1.0f - blend) * glm::vec3(1.0f, 0.235f, 0.976f)
+           + blend * glm::vec3(0.224f, 0.996f, 1.0f);
+}
 
-    // If there is no intersection with an object, just return background color
+//---------------------------------------------------------------------------------------
+// Get a colour for a ray from its closest intersection with the scene
+Color RayTracer::shade(Ray& ray, const Intersection& intersection, const int currDepth) const
+{
+    // If there is no intersection with an object, just return background gradient
     // Note: we do not care about primary intersections with light source
     if (!intersection.m_foundIntersection)
     {
-        return color;
+        return background(ray);
     }
 
     // Compute ambient component once we have an intersection
-    color = intersection.m_material->kd(intersection.m_uv) * m_ambient;
+    glm::vec3 color = intersection.m_material->kd(intersection.m_uv) * m_ambient;
 
     // Send rays from intersection point to each light source
-    std::vector<Light*> unblockedLights;
-    for (Light* light: m_lights)
+    std::vector<const Light*> unblockedLights;
+    for (const Light& light: m_snapshot.lights())
     {
-        glm::vec3 shadowDir = light->m_position - intersection.m_point; // Not normalized
+        // The light is at a parametric distance of 1, as the direction is not normalized
+        glm::vec3 shadowDir = light.m_position - intersection.m_point;
         Ray shadow = Ray(intersection.m_point, shadowDir, ray.time());
 
-        // Loop through every geometry
-        Intersection _; // We don't care about the point itself, just if it intersects
-        _.m_point = light->m_position; // Intersections shouldn't be past light pos
-        _.m_isLight = true;
-        traverseSceneGraph(m_root, shadow, _, glm::mat4(), glm::mat4());
-
-        // Only add to unblocked lights if there are no intersections
-        if (!_.m_foundIntersection)
+        // Only add to unblocked lights if nothing is in the way
+        if (!occluded(shadow, 1.0f))
         {
-            unblockedLights.push_back(light);
+            unblockedLights.push_back(&light);
         }
     }
 
@@ -158,7 +241,7 @@ Color RayTracer::raytrace(Ray& ray, const int currDepth) const
     // Recursively send rays to get color of reflection
     // Stop recursion after some number of reflections or if material does not reflect
     Color reflectedColor(0.0f);
-    if (currDepth < MAX_DEPTH &&
+    if (currDepth < m_settings.maxDepth &&
         intersection.m_material->kr(intersection.m_uv) != glm::vec3(0.0f))
     {
         glm::vec3 normalized_i = glm::normalize(ray.direction());
@@ -177,58 +260,552 @@ Color RayTracer::raytrace(Ray& ray, const int currDepth) const
 }
 
 //---------------------------------------------------------------------------------------
-// Render a part of an image using multithreaded raytracing
-void RayTracer::render(
+// Intersect a packet of primary rays, which all start at the eye and stay inside frustum
+// Sets intersections to the closest intersection of every ray
+void RayTracer::intersectPacket(
+    const std::vector<Ray>& rays,
+    const Frustum& frustum,
+    std::vector<Intersection>& intersections
+) const
+{
+    intersections.assign(rays.size(), Intersection());
+
+    // Find the instances the packet may hit with a single walk of the hierarchy, and fall
+    // back to tracing every ray on its own if the rays are spread over too many of them
+    std::vector<uint32_t> instanceIndices;
+    if (!m_sceneBVH.cull(frustum, MAX_PACKET_INSTANCES, instanceIndices))
+    {
+        for (size_t r = 0; r < rays.size(); r++)
+        {
+            intersectScene(rays[r], intersections[r]);
+        }
+        return;
+    }
+
+    // Order the instances from the closest to the eye, so rays find their closest hit
+    // early and skip the instances behind it
+    const std::vector<SceneInstance>& instances = m_snapshot.instances();
+    auto eyeDistance = [&](const uint32_t index) {
+        const AABB& bounds = instances[index].bounds;
+        return glm::length(glm::clamp(m_eye, bounds.min, bounds.max) - m_eye);
+    };
+    std::sort(instanceIndices.begin(), instanceIndices.end(),
+              [&](const uint32_t a, const uint32_t b) {
+                  return eyeDistance(a) < eyeDistance(b);
+              });
+
+    // Pack their boxes into nodes, so each ray tests four boxes at once
+    std::vector<WideBVHNode> groups((instanceIndices.size() + WideBVHNode::WIDTH - 1) /
+                                    WideBVHNode::WIDTH);
+    for (size_t k = 0; k < instanceIndices.size(); k++)
+    {
+        WideBVHNode& group = groups[k / WideBVHNode::WIDTH];
+        const int i = static_cast<int>(group.numChildren++);
+        group.setBounds(i, instances[instanceIndices[k]].bounds);
+        group.child[i] = instanceIndices[k];
+        group.count[i] = 1;
+    }
+
+    for (size_t r = 0; r < rays.size(); r++)
+    {
+        const Ray& ray = rays[r];
+        const glm::vec3 invDir = 1.0f / ray.direction();
+
+        Hit hit{};
+        bool found = false;
+        float tMax = std::numeric_limits<float>::max();
+        for (const WideBVHNode& group: groups)
+        {
+            float tNear[WideBVHNode::WIDTH];
+            int mask = group.intersect(ray.origin(), invDir, tMax, tNear);
+            for (int i = 0; mask != 0; i++, mask >>= 1)
+            {
+                if ((mask & 1) && tNear[i] <= tMax)
+                {
+                    found |= intersectInstance(ray, group.child[i], hit, tMax);
+                }
+            }
+        }
+
+        if (found)
+        {
+            finalizeHit(ray, hit, intersections[r]);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * sortRays orders rays so that rays going in similar directions from nearby origins are
+ * traced one after another. Rays are sorted by the octant of their direction, then along
+ * a Morton curve through the box around their origins.
+ * @param rays Rays to sort
+ * @return Indices into rays in the sorted order
+ */
+static std::vector<uint32_t> sortRays(const std::vector<Ray>& rays)
+{
+    AABB originBounds;
+    for (const Ray& ray: rays)
+    {
+        originBounds.extend(ray.origin());
+    }
+    const glm::vec3 scale = 1023.0f / glm::max(originBounds.extent(), glm::vec3(1e-6f));
+
+    // Spread the lower 10 bits of v out to every third bit
+    auto spreadBits = [](uint32_t v) {
+        v = (v | (v << 16)) & 0x030000ffu;
+        v = (v | (v << 8)) & 0x0300f00fu;
+        v = (v | (v << 4)) & 0x030c30c3u;
+        v = (v | (v << 2)) & 0x09249249u;
+        return v;
+    };
+
+    std::vector<std::pair<uint32_t, uint32_t>> keys(rays.size());
+    for (size_t r = 0; r < rays.size(); r++)
+    {
+        const glm::vec3 d = rays[r].direction();
+        const uint32_t octant = (d.x < 0.0f) | ((d.y < 0.0f) << 1) | ((d.z < 0.0f) << 2);
+        const glm::uvec3 cell((rays[r].origin() - originBounds.min) * scale);
+        const uint32_t morton = spreadBits(cell.x) | (spreadBits(cell.y) << 1) |
+                                (spreadBits(cell.z) << 2);
+        keys[r] = {(octant << 30) | morton, static_cast<uint32_t>(r)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> order(rays.size());
+    for (size_t r = 0; r < rays.size(); r++)
+    {
+        order[r] = keys[r].second;
+    }
+    return order;
+}
+
+//---------------------------------------------------------------------------------------
+// Trace the rays spawned by a packet of primary rays one bounce at a time
+// Adds the colour of every primary ray r to colors[r]
+void RayTracer::traceWavefront(
+    const std::vector<Ray>& rays,
+    const std::vector<Intersection>& intersections,
+    Color* colors
+) const
+{
+    const std::vector<Light>& lights = m_snapshot.lights();
+
+    // Rays of the current bounce, with the primary ray they add to and the product of
+    // the reflectivities along their path
+    std::vector<Ray> bounceRays = rays;
+    std::vector<Intersection> hits = intersections;
+    std::vector<uint32_t> pixels(rays.size());
+    std::vector<Color> weights(rays.size(), Color(1.0f));
+    for (size_t r = 0; r < rays.size(); r++)
+    {
+        pixels[r] = static_cast<uint32_t>(r);
+    }
+
+    for (int depth = 0; !bounceRays.empty(); depth++)
+    {
+        // Primary rays have been intersected as a packet already
+        if (depth > 0)
+        {
+            hits.assign(bounceRays.size(), Intersection());
+            for (const uint32_t r: sortRays(bounceRays))
+            {
+                intersectScene(bounceRays[r], hits[r]);
+            }
+        }
+
+        // Shade the hits grouped by material, misses first
+        std::vector<uint32_t> order;
+        for (uint32_t r = 0; r < bounceRays.size(); r++)
+        {
+            if (hits[r].m_foundIntersection)
+            {
+                order.push_back(r);
+            }
+            else
+            {
+                colors[pixels[r]] += weights[r] * background(bounceRays[r]);
+            }
+        }
+        const auto byMaterial = [&](const uint32_t a, const uint32_t b) {
+            return hits[a].m_material < hits[b].m_material;
+        };
+        std::stable_sort(order.begin(), order.end(), byMaterial);
+
+        // Send a ray from every hit to each light source, all traced together
+        std::vector<Ray> shadowRays;
+        shadowRays.reserve(order.size() * lights.size());
+        for (const uint32_t r: order)
+        {
+            for (const Light& light: lights)
+            {
+                glm::vec3 shadowDir = light.m_position - hits[r].m_point; // Light at t = 1
+                shadowRays.emplace_back(hits[r].m_point, shadowDir, bounceRays[r].time());
+            }
+        }
+
+        std::vector<bool> unblocked(shadowRays.size());
+        for (const uint32_t s: sortRays(shadowRays))
+        {
+            unblocked[s] = !occluded(shadowRays[s], 1.0f);
+        }
+
+        std::vector<Ray> nextRays;
+        std::vector<uint32_t> nextPixels;
+        std::vector<Color> nextWeights;
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            const uint32_t r = order[k];
+            const Intersection& intersection = hits[r];
+            const PhongMaterial* material = intersection.m_material;
+
+            // Compute v = vector from point to eye and normalize
+            glm::vec3 v = glm::normalize(m_eye - intersection.m_point);
+
+            // Sum the light from diffuse and specular components for each unblocked light
+            glm::vec3 diffuseComponent(0.0f);
+            glm::vec3 specularComponent(0.0f);
+            for (size_t i = 0; i < lights.size(); i++)
+            {
+                if (!unblocked[k * lights.size() + i])
+                {
+                    continue;
+                }
+
+                const Light* light = &lights[i];
+                glm::vec3 l = light->m_position - intersection.m_point;
+                float dist = glm::length(l);
+                l /= dist;
+                glm::vec3 h = glm::normalize(l + v);
+
+                float attenuation = light->m_falloff[0] +
+                                    light->m_falloff[1] * dist +
+                                    light->m_falloff[2] * pow(dist, 2);
+
+                glm::vec3 common = light->m_colour / attenuation;
+                diffuseComponent += (std::max(0.0f, glm::dot(l, intersection.m_normal))
+                                     * common);
+                specularComponent += (pow(glm::dot(h, intersection.m_normal),
+                                          material->shininess())
+                                      * common);
+            }
+
+            colors[pixels[r]] += weights[r] *
+                                 (material->kd(intersection.m_uv) * m_ambient +
+                                  material->kd(intersection.m_uv) * diffuseComponent +
+                                  material->ks(intersection.m_uv) * specularComponent);
+
+            // Queue the reflection for the next bounce, weighted by the reflectivity
+            const glm::vec3 kr = material->kr(intersection.m_uv);
+            if (depth < m_settings.maxDepth && kr != glm::vec3(0.0f))
+            {
+                glm::vec3 normalized_i = glm::normalize(bounceRays[r].direction());
+                glm::vec3 reflectedDir = normalized_i -
+                                         2 * intersection.m_normal *
+                                         glm::dot(normalized_i, intersection.m_normal);
+                nextRays.emplace_back(intersection.m_point, reflectedDir, bounceRays[r].time());
+                nextPixels.push_back(pixels[r]);
+                nextWeights.push_back(weights[r] * kr);
+            }
+        }
+
+        bounceRays = std::move(nextRays);
+        pixels = std::move(nextPixels);
+        weights = std::move(nextWeights);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Direction from the eye through a point on the screen, in world coordinates
+glm::vec3 RayTracer::screenDirection(const float x, const float y) const
+{
+    const glm::vec4 p_world = m_screenToWorld * glm::vec4(x, y, 0, 1);
+    return glm::vec3(p_world) - m_eye;
+}
+
+//---------------------------------------------------------------------------------------
+// Frustum bounding every primary ray of the pixels [startX, endX) x [startY, endY)
+Frustum RayTracer::packetFrustum(
+    const int startX,
+    const int endX,
+    const int startY,
+    const int endY
+) const
+{
+    // Every jittered ray of the block passes through the screen rectangle covering its
+    // pixels, grown a little so rays on its edges are not lost to rounding
+    const float margin = 0.5f + 1e-3f;
+    const glm::vec3 edges[Frustum::NUM_PLANES] = {
+        screenDirection(startX - margin, startY - margin),
+        screenDirection(endX - 1 + margin, startY - margin),
+        screenDirection(endX - 1 + margin, endY - 1 + margin),
+        screenDirection(startX - margin, endY - 1 + margin)
+    };
+    return Frustum(m_eye, edges);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * traceSamples traces samples [firstSample, firstSample + numSamples) of each of the
+ * pixels in a single packet, ordered by sample.
+ * @param frustum Bounds every primary ray of the pixels
+ * @param pixels Pixels to take the samples of
+ * @param samples Set to the colour of each sample, sample k of pixels[p] is at
+ * (k - firstSample) * pixels.size() + p
+ */
+void RayTracer::traceSamples(
+    Sampler& sampler,
+    const int frameNum,
+    const Frustum& frustum,
+    const std::vector<glm::ivec2>& pixels,
+    const int firstSample,
+    const int numSamples,
+    std::vector<Color>& samples
+) const
+{
+    std::vector<Ray> rays;
+    rays.reserve(numSamples * pixels.size());
+    for (int k = firstSample; k < firstSample + numSamples; k++)
+    {
+        for (const glm::ivec2& pixel: pixels)
+        {
+            // Jitter the ray a little between [-0.5, 0.5]
+            sampler.startPixelSample(pixel, frameNum, k);
+            const glm::vec2 jitter = sampler.get2D();
+            float x = pixel.x + jitter.x - 0.5f;
+            float y = pixel.y + jitter.y - 0.5f;
+
+            // Spread the samples over the time the shutter is open
+            float time = frameNum;
+            if (m_shutter > 0.0f)
+            {
+                time += m_shutter * sampler.get1D();
+            }
+
+            // Create a ray from camera to pixel in world coordinates
+            rays.emplace_back(m_eye, screenDirection(x, y), time);
+            rays.back().m_id = pixel.x * (*m_image).height() + pixel.y;
+        }
+    }
+
+    std::vector<Intersection> intersections;
+    intersectPacket(rays, frustum, intersections);
+
+    samples.assign(rays.size(), Color(0.0f));
+    if (INTEGRATOR == Integrator::Wavefront)
+    {
+        traceWavefront(rays, intersections, samples.data());
+    }
+    else
+    {
+        for (size_t r = 0; r < rays.size(); r++)
+        {
+            samples[r] = shade(rays[r], intersections[r], 0);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * renderTile renders the tile [startX, endX) x [startY, endY) of the image with packets
+ * of primary rays. Every pixel takes the minimum number of samples first, then the pixels
+ * that are still noisy keep doubling their samples until they converge. The noise of the
+ * whole tile is checked between batches, so pixels at the edge of a packet see their
+ * neighbours in the next packet.
+ * @return Number of samples taken
+ */
+size_t RayTracer::renderTile(
+    Sampler& sampler,
     const int frameNum,
-    const int threadNum,
-    const int startWidth,
-    const int endWidth
+    const int startX,
+    const int endX,
+    const int startY,
+    const int endY
 ) const
 {
-    // Iterate through each pixel of the image
-    const int percentage_interval = 10.0f;
-    int interval = (endWidth - startWidth) / percentage_interval;
-    for (int i = startWidth; i < endWidth; i++)
+    // Sum of the samples of each pixel, and the sums of the samples and their squares
+    // clamped to what the image can show, to estimate how noisy the pixel still is
+    const int width = endX - startX;
+    const int height = endY - startY;
+    const size_t numPixels = width * height;
+    std::vector<Color> colors(numPixels, Color(0.0f));
+    std::vector<Color> sums(numPixels, Color(0.0f));
+    std::vector<Color> squares(numPixels, Color(0.0f));
+    std::vector<int> numSamples(numPixels, 0);
+
+    // The packets of the tile, each traced against its own frustum
+    const int packetsY = (height + PACKET_SIZE - 1) / PACKET_SIZE;
+    std::vector<Frustum> frustums;
+    for (int i = startX; i < endX; i += PACKET_SIZE)
     {
-        for (int j = 0; j < (*m_image).height(); j++)
+        for (int j = startY; j < endY; j += PACKET_SIZE)
         {
-            Color color(0.0f);
-            for (int k = 0; k < SAMPLE_SIZE; k++)
+            frustums.push_back(packetFrustum(i, std::min(i + PACKET_SIZE, endX),
+                                             j, std::min(j + PACKET_SIZE, endY)));
+        }
+    }
+
+    // Pixels still taking samples, which have all taken the same number so far
+    std::vector<uint32_t> active(numPixels);
+    for (uint32_t p = 0; p < numPixels; p++)
+    {
+        active[p] = p;
+    }
+
+    size_t samplesTaken = 0;
+    int batchSize = m_settings.minSamples;
+    std::vector<std::vector<uint32_t>> packetActive(frustums.size());
+    std::vector<glm::ivec2> pixels;
+    std::vector<Color> samples;
+    while (!active.empty())
+    {
+        for (std::vector<uint32_t>& packet: packetActive)
+        {
+            packet.clear();
+        }
+        for (const uint32_t p: active)
+        {
+            const int x = static_cast<int>(p) / height;
+            const int y = static_cast<int>(p) % height;
+            packetActive[(x / PACKET_SIZE) * packetsY + y / PACKET_SIZE].push_back(p);
+        }
+
+        // Every sample of the active pixels of a packet is traced in the same packet
+        const int firstSample = numSamples[active[0]];
+        for (size_t packet = 0; packet < frustums.size(); packet++)
+        {
+            const std::vector<uint32_t>& packetPixels = packetActive[packet];
+            if (packetPixels.empty())
             {
-                // Jitter the ray a little between [-0.5, 0.5]
-                glm::vec4 p(i, j, 0, 1); // Set z = 0 at first
-                p.x += (static_cast<float>(std::rand()) / RAND_MAX) - 0.5f;
-                p.y += (static_cast<float>(std::rand()) / RAND_MAX) - 0.5f;
+                continue;
+            }
 
-                // Convert from screen coordinates to world coordinates
-                glm::vec4 p_world = m_screenToWorld * p;
+            pixels.clear();
+            for (const uint32_t p: packetPixels)
+            {
+                pixels.emplace_back(startX + p / height, startY + p % height);
+            }
+            traceSamples(sampler, frameNum, frustums[packet], pixels, firstSample,
+                         batchSize, samples);
+            samplesTaken += samples.size();
 
-                // Create a ray from camera to pixel in world coordinates
-                glm::vec4 direction = p_world - glm::vec4(m_eye, 0);
-                Ray ray = Ray(m_eye, glm::vec3(direction), frameNum);
-                ray.m_id = i * (*m_image).height() + j;
+            for (size_t r = 0; r < samples.size(); r++)
+            {
+                const uint32_t p = packetPixels[r % packetPixels.size()];
+                const Color clamped = glm::clamp(samples[r], 0.0f, 1.0f);
+                colors[p] += samples[r];
+                sums[p] += clamped;
+                squares[p] += clamped * clamped;
+            }
+        }
+        const int taken = firstSample + batchSize;
+        for (const uint32_t p: active)
+        {
+            numSamples[p] = taken;
+        }
+        if (taken >= m_settings.maxSamples)
+        {
+            break;
+        }
 
-                // Check for ray intersections with objects
-                color += raytrace(ray, 0);
+        // Find the pixels whose mean colour is still further than the threshold from the
+        // true colour, going by its standard error
+        std::vector<bool> noisy(numPixels, false);
+        for (const uint32_t p: active)
+        {
+            const Color mean = sums[p] / static_cast<float>(taken);
+            const Color variance = (squares[p] - mean * sums[p]) /
+                                   static_cast<float>(taken - 1);
+            const Color error = glm::sqrt(glm::max(variance, 0.0f) /
+                                          static_cast<float>(taken));
+            noisy[p] = std::max({error.r, error.g, error.b}) > m_settings.threshold;
+        }
+
+        // Few samples can all miss a small feature, so pixels keep sampling while any of
+        // their neighbours are noisy too
+        std::vector<uint32_t> stillActive;
+        for (const uint32_t p: active)
+        {
+            const int x = static_cast<int>(p) / height;
+            const int y = static_cast<int>(p) % height;
+            bool keep = false;
+            for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); nx++)
+            {
+                for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ny++)
+                {
+                    keep = keep || noisy[nx * height + ny];
+                }
             }
+            if (keep)
+            {
+                stillActive.push_back(p);
+            }
+        }
+        active = std::move(stillActive);
+        batchSize = std::min(taken, m_settings.maxSamples - taken);
+    }
 
+    size_t r = 0;
+    for (int i = startX; i < endX; i++)
+    {
+        for (int j = startY; j < endY; j++)
+        {
             // Average the samples
-            color /= static_cast<float>(SAMPLE_SIZE);
+            const Color color = colors[r] / static_cast<float>(numSamples[r]);
+            r++;
 
             // Set colour based on intersection (RGB)
             (*m_image)(i, j, 0) = (double) color.r;
             (*m_image)(i, j, 1) = (double) color.g;
             (*m_image)(i, j, 2) = (double) color.b;
         }
+    }
+    return samplesTaken;
+}
 
-#ifdef DEBUG_LOGS
-        if ((i - startWidth) % interval == 0)
+//---------------------------------------------------------------------------------------
+/**
+ * renderPass takes one more sample of every pixel of the tile [startX, endX) x
+ * [startY, endY) for a progressive render, one packet at a time.
+ * @param sampleIndex Index of the sample in every pixel, which is the number of passes
+ * rendered before
+ * @param accumulation Buffer the samples are added to
+ */
+void RayTracer::renderPass(
+    Sampler& sampler,
+    const int frameNum,
+    const int sampleIndex,
+    const int startX,
+    const int endX,
+    const int startY,
+    const int endY,
+    AccumulationBuffer& accumulation
+) const
+{
+    std::vector<glm::ivec2> pixels;
+    std::vector<Color> samples;
+    for (int i = startX; i < endX; i += PACKET_SIZE)
+    {
+        for (int j = startY; j < endY; j += PACKET_SIZE)
         {
-            std::cout << " - Rendering thread " << threadNum << ": "
-                    << ((i - startWidth) / interval) * percentage_interval << "%"
-                    << std::endl;
+            const int packetEndX = std::min(i + PACKET_SIZE, endX);
+            const int packetEndY = std::min(j + PACKET_SIZE, endY);
+            pixels.clear();
+            for (int x = i; x < packetEndX; x++)
+            {
+                for (int y = j; y < packetEndY; y++)
+                {
+                    pixels.emplace_back(x, y);
+                }
+            }
+
+            traceSamples(sampler, frameNum, packetFrustum(i, packetEndX, j, packetEndY),
+                         pixels, sampleIndex, 1, samples);
+            for (size_t p = 0; p < pixels.size(); p++)
+            {
+                accumulation.add(pixels[p].x, pixels[p].y, samples[p]);
+            }
         }
-#endif
     }
 }
 
@@ -253,7 +830,13 @@ void A5_Render(
     // Lighting parameters  
     const glm::vec3& ambient,
     const std::list<Light*>& lights,
-    const std::list<ParticleNode*>& particleSpawners
+    const std::list<ParticleNode*>& particleSpawners,
+
+    // Motion blur
+    const float shutter,
+
+    // Samples, threads and output of the render
+    const RenderSettings& settings
 )
 {
     // Set up animations for lights here (lua is hard)
@@ -280,9 +863,85 @@ void A5_Render(
        * Ray Tracing Main Function Code
        */
 
-    // Render each frame
+    // Frames this process renders, of the ones the scene asks for
+    std::vector<int> frames;
     for (int frame = startFrame; frame < (startFrame + numFrames); frame++)
     {
+        if (settings.rendersFrame(frame, startFrame))
+        {
+            frames.push_back(frame);
+        }
+    }
+    if (settings.workers > 0)
+    {
+        renderFramesInWorkers(frames, settings.workers, settings.threads, settings.report,
+                              settings.logs);
+        return;
+    }
+
+    // The thread count also applies to the hierarchies built for every frame
+    setWorkerThreadCount(settings.threads);
+    RenderSettings frameSettings = settings;
+    frameSettings.threads = workerThreadCount();
+    const std::string outputName = settings.output.empty() ? fileName : settings.output;
+    const int tileSize = settings.tileSize;
+
+    // The render threads and their samplers are kept for every frame
+    ThreadPool pool(frameSettings.threads);
+    std::vector<std::unique_ptr<Sampler>> samplers;
+    const int samplesPerPixel =
+        settings.progressive() ? MAX_PROGRESSIVE_PASSES : settings.maxSamples;
+    for (unsigned int i = 0; i < pool.size(); i++)
+    {
+        samplers.push_back(createSampler(SAMPLER, samplesPerPixel, settings.seed));
+    }
+
+    // Either render the tiles a coordinator asks for, or hand tiles out to workers
+    std::unique_ptr<TileServer> server;
+    if (!settings.serve.empty())
+    {
+        server = std::make_unique<TileServer>(settings.serve);
+        if (settings.logs)
+        {
+            std::cout << "----- Waiting for a coordinator on " << settings.serve << " -----"
+                      << std::endl;
+        }
+        if (!server->accept(image.width(), image.height()))
+        {
+            std::cerr << "No coordinator connected on " << settings.serve << std::endl;
+            return;
+        }
+    }
+    std::vector<std::unique_ptr<TileClient>> remoteWorkers;
+    for (const std::string& address: settings.connect)
+    {
+        std::unique_ptr<TileClient> worker =
+            TileClient::connect(address, image.width(), image.height());
+        if (worker)
+        {
+            remoteWorkers.push_back(std::move(worker));
+        }
+    }
+
+    // Particles are spawned from the first frame of the animation on, whichever frames
+    // this process renders
+    for (ParticleNode* particles: particleSpawners)
+    {
+        particles->setFirstFrame(startFrame);
+    }
+
+    // A frame is prepared by placing the camera and compiling a snapshot of the scene,
+    // which only reads the scene, so the next frame is prepared while this one renders
+    struct PreparedFrame {
+        int frame;
+        std::unique_ptr<RayTracer> raytracer;
+        std::chrono::duration<double, std::milli> buildTime;
+    };
+    const int nx = static_cast<int>(image.width());
+    const int ny = static_cast<int>(image.height());
+    const auto prepareFrame = [&](const int frame) {
+        auto buildStart = std::chrono::steady_clock::now();
+
         // Animations for the camera and view (lua is hard)
         glm::vec3 updatedEye = eye;
         glm::vec3 updatedView = view;
@@ -300,8 +959,6 @@ void A5_Render(
         /*
         * Transformation matricies to create viewing rays
         */
-        const int nx = static_cast<int>(image.width());
-        const int ny = static_cast<int>(image.height());
         const float d = 1.0f;
         glm::mat4 T1 = glm::translate(glm::mat4(),
                                       glm::vec3(
@@ -339,70 +996,255 @@ void A5_Render(
         glm::mat4 M = T4 * R3 * S2 * T1; // This is the final matrix for screen -> world
 
         // Create RayTracer object
-        RayTracer raytracer(root, M, updatedEye, ambient, lights, &image);
+        auto raytracer = std::make_unique<RayTracer>(root, M, updatedEye, ambient, lights,
+                                                     &image, shutter, frameSettings);
+
+        // Evaluate the animations, lights and particles of the frame into a snapshot of
+        // the scene, and build the top level hierarchy over it
+        raytracer->compileScene(frame, frame + shutter);
+
+        return PreparedFrame{frame, std::move(raytracer),
+                             std::chrono::steady_clock::now() - buildStart};
+    };
+
+    // Images are written on other threads while the next frames render
+    ImageWriter writer;
 
-        // At the start of each frame, preprocess each particle system
-        for (ParticleNode* particles: particleSpawners)
+    // Time spent in each stage over all frames, and waiting on the other stages
+    std::chrono::duration<double, std::milli> totalBuildTime(0.0);
+    std::chrono::duration<double, std::milli> totalRenderTime(0.0);
+    std::chrono::duration<double, std::milli> totalWriteTime(0.0);
+    std::chrono::duration<double, std::milli> totalWaitTime(0.0);
+    const auto reportWrites = [&]() {
+        for (const WrittenImage& written: writer.takeWritten())
         {
-            particles->preprocessParticles(frame);
+            totalWriteTime += written.writeTime;
+            if (!written.written)
+            {
+                std::cerr << "Could not write " << written.path << std::endl;
+            }
+            else if (settings.logs)
+            {
+                std::cout << " - Wrote " << written.path << " in "
+                          << written.writeTime.count() << " ms" << std::endl;
+            }
         }
+    };
+    const auto writeImage = [&](const std::string& path) {
+        const auto waitStart = std::chrono::steady_clock::now();
+        writer.write(Image(image), path);
+        totalWaitTime += std::chrono::steady_clock::now() - waitStart;
+        reportWrites();
+    };
 
-        // Preprocess animations
-        raytracer.preprocessAnimation(root, frame);
-
-        // Preprocess lights
-        for (Light* light: lights)
+    // Render each frame
+    const auto jobStart = std::chrono::steady_clock::now();
+    std::future<PreparedFrame> nextFrame;
+    if (!frames.empty())
+    {
+        nextFrame = std::async(std::launch::async, prepareFrame, frames.front());
+    }
+    for (size_t f = 0; f < frames.size(); f++)
+    {
+        const auto waitStart = std::chrono::steady_clock::now();
+        const PreparedFrame prepared = nextFrame.get();
+        totalWaitTime += std::chrono::steady_clock::now() - waitStart;
+        if (f + 1 < frames.size())
         {
-            light->animateLight(frame);
+            nextFrame = std::async(std::launch::async, prepareFrame, frames[f + 1]);
         }
 
-        // Multithread  by passing a slice of the image to a thread
-        int numThreads = std::min(
-            static_cast<unsigned int>(16),
-            std::thread::hardware_concurrency()
-        );
-        int threadWidth = nx / numThreads;
-        std::vector<std::thread> threads;
+        const int frame = prepared.frame;
+        const RayTracer& raytracer = *prepared.raytracer;
+        const std::chrono::duration<double, std::milli>& buildTime = prepared.buildTime;
+        totalBuildTime += buildTime;
+        auto renderStart = std::chrono::steady_clock::now();
 
-#ifdef DEBUG_LOGS
-        std::cout << "----- Starting render for frame: " << frame << " -----" << std::endl;
-        std::cout << "----- Using " << numThreads << " threads -----" << std::endl;
-#endif
+        // Multithread by splitting the image into tiles the workers take from each other
+        const int tilesX = (nx + tileSize - 1) / tileSize;
+        const int tilesY = (ny + tileSize - 1) / tileSize;
+        const int numTiles = tilesX * tilesY;
 
-        for (int i = 0; i < numThreads; i++)
+        // Name of the image of the frame
+        std::stringstream fileNum;
+        if (numFrames > 1 || startFrame != 0)
         {
-            int startWidth = i * threadWidth;
-            int endWidth = (i == (numThreads - 1)) ? ny : (i + 1) * threadWidth;
-            threads.emplace_back(&RayTracer::render,
-                                 raytracer, frame, i, startWidth, endWidth);
+            fileNum << "_" << std::setw(4) << std::setfill('0') << frame;
+        }
+        fileNum << ".png";
+        const std::string imagePath = outputName + fileNum.str();
+
+        if (settings.logs)
+        {
+            std::cout << "----- Starting render for frame: " << frame << " -----"
+                      << std::endl;
+            std::cout << "----- Using " << pool.size() << " threads -----" << std::endl;
         }
+        std::atomic<int> tilesDone(0);
+        std::atomic<size_t> samplesTaken(0);
+        int numPasses = 0;
+        float noise = 0.0f;
 
-        // Wait for threads to finish
-        for (std::thread& thread: threads)
+        if (settings.progressive())
         {
-            thread.join();
+            // Take one sample of every pixel per pass until the time runs out or the image
+            // is clean enough, writing out the image so far at every checkpoint
+            AccumulationBuffer accumulation(nx, ny);
+            const std::chrono::duration<double> budget(settings.timeBudget);
+            const std::chrono::duration<double> checkpoint(settings.checkpoint);
+            auto nextCheckpoint = renderStart + checkpoint;
+            while (numPasses < MAX_PROGRESSIVE_PASSES)
+            {
+                pool.run(numTiles, [&](const uint32_t tile, const unsigned int worker) {
+                    const int startX = static_cast<int>(tile % tilesX) * tileSize;
+                    const int startY = static_cast<int>(tile / tilesX) * tileSize;
+                    const int endX = std::min(startX + tileSize, nx);
+                    const int endY = std::min(startY + tileSize, ny);
+                    raytracer.renderPass(*samplers[worker], frame, numPasses,
+                                         startX, endX, startY, endY, accumulation);
+                });
+                numPasses++;
+
+                if (numPasses >= 2)
+                {
+                    noise = accumulation.noise(numPasses);
+                    if (noise <= settings.noiseTarget)
+                    {
+                        break;
+                    }
+                }
+
+                // Stop once another pass, as long as the average pass so far, would not
+                // finish within the budget
+                const auto now = std::chrono::steady_clock::now();
+                const auto elapsed = now - renderStart;
+                if (settings.timeBudget > 0.0f &&
+                    elapsed + elapsed / numPasses > budget)
+                {
+                    break;
+                }
+
+                if (settings.checkpoint > 0.0f && now >= nextCheckpoint)
+                {
+                    accumulation.resolve(image, numPasses);
+                    if (settings.logs)
+                    {
+                        std::cout << " - Checkpoint after " << numPasses << " passes"
+                                  << std::endl;
+                    }
+                    writeImage(imagePath);
+                    nextCheckpoint = now + checkpoint;
+                }
+            }
+            accumulation.resolve(image, numPasses);
+            samplesTaken = static_cast<size_t>(numPasses) * nx * ny;
+        }
+        else
+        {
+            // Render a rectangle of the image on the threads of this process
+            const auto renderRect = [&](const TileRect& rect, const bool showProgress) {
+                const int rectTilesX = (rect.endX - rect.startX + tileSize - 1) / tileSize;
+                const int rectTilesY = (rect.endY - rect.startY + tileSize - 1) / tileSize;
+                const int rectTiles = rectTilesX * rectTilesY;
+                tilesDone = 0;
+                pool.run(rectTiles, [&](const uint32_t tile, const unsigned int worker) {
+                    const int startX = rect.startX + static_cast<int>(tile % rectTilesX) *
+                                                     tileSize;
+                    const int startY = rect.startY + static_cast<int>(tile / rectTilesX) *
+                                                     tileSize;
+                    const int endX = std::min(startX + tileSize, rect.endX);
+                    const int endY = std::min(startY + tileSize, rect.endY);
+                    samplesTaken += raytracer.renderTile(*samplers[worker], frame,
+                                                         startX, endX, startY, endY);
+
+                    const int percentage_interval = 10;
+                    const int done = ++tilesDone;
+                    if (showProgress && done * percentage_interval / rectTiles !=
+                                        (done - 1) * percentage_interval / rectTiles)
+                    {
+                        std::cout << " - Rendered " << done * 100 / rectTiles << "%"
+                                  << std::endl;
+                    }
+                });
+            };
+
+            if (server)
+            {
+                const auto renderRequest = [&](const TileRect& rect) {
+                    renderRect(rect, false);
+                };
+                if (!server->serveFrame(frame, renderRequest, image))
+                {
+                    break;
+                }
+            }
+            else if (!remoteWorkers.empty())
+            {
+                std::vector<TileRect> rects;
+                for (int y = 0; y < ny; y += REMOTE_TILE_SIZE)
+                {
+                    for (int x = 0; x < nx; x += REMOTE_TILE_SIZE)
+                    {
+                        rects.push_back({frame, x, std::min(x + REMOTE_TILE_SIZE, nx),
+                                         y, std::min(y + REMOTE_TILE_SIZE, ny)});
+                    }
+                }
+
+                // Render the tiles of lost workers here
+                for (const TileRect& rect: renderRemotely(remoteWorkers, rects, image))
+                {
+                    renderRect(rect, false);
+                }
+            }
+            else
+            {
+                renderRect({frame, 0, nx, 0, ny}, settings.logs);
+            }
         }
 
-#ifdef DEBUG_LOGS
-        std::cout << "----- All threads completed -----" << std::endl;
-#endif
+        std::chrono::duration<double, std::milli> renderTime =
+            std::chrono::steady_clock::now() - renderStart;
+        totalRenderTime += renderTime;
 
-        // After each frame  done rendering, reset animations to default
-        raytracer.resetAnimation(root);
-        for (Light* light: lights)
+        if (settings.logs)
         {
-            light->resetAnimation();
+            std::cout << "----- All threads completed -----" << std::endl;
+            std::cout << "----- Built frame in " << buildTime.count() << " ms, rendered in "
+                      << renderTime.count() << " ms -----" << std::endl;
+            if (!server && remoteWorkers.empty())
+            {
+                std::cout << "----- Took " << static_cast<double>(samplesTaken) / (nx * ny)
+                          << " samples per pixel -----" << std::endl;
+            }
+            if (numPasses >= 2)
+            {
+                std::cout << "----- Estimated noise " << noise << " -----" << std::endl;
+            }
         }
 
-        // Save image to disk
-        std::stringstream fileNum;
-        if (numFrames > 1 || startFrame != 0)
+        // Save image to disk, the coordinator saves the images of workers
+        if (!server)
         {
-            fileNum << "_" << std::setw(4) << std::setfill('0') << frame;
+            writeImage(imagePath);
         }
-        fileNum << ".png";
-        image.savePng(fileName + fileNum.str());
     }
+    const auto waitStart = std::chrono::steady_clock::now();
+    writer.finish();
+    totalWaitTime += std::chrono::steady_clock::now() - waitStart;
+    reportWrites();
+    std::chrono::duration<double, std::milli> jobTime =
+        std::chrono::steady_clock::now() - jobStart;
+
+    if (!settings.logs)
+    {
+        return;
+    }
+
+    // Stages overlap, so together they take longer than the frames did
+    std::cout << "----- Rendered " << frames.size() << " frames in " << jobTime.count()
+              << " ms: preparing " << totalBuildTime.count() << " ms, rendering "
+              << totalRenderTime.count() << " ms, writing " << totalWriteTime.count()
+              << " ms, waiting " << totalWaitTime.count() << " ms -----" << std::endl;
 
     std::cout << "A5_Render(\n" <<
             "\t" << *root <<
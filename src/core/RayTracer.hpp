@@ -1,26 +1,112 @@
 #pragma once
 
+#include <limits>
+#include <string>
+#include <vector>
+
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 
+#include "acceleration/Frustum.hpp"
+#include "acceleration/SceneBVH.hpp"
+#include "core/AccumulationBuffer.hpp"
 #include "core/Ray.hpp"
+#include "core/Sampler.hpp"
+#include "core/SceneSnapshot.hpp"
 #include "geometry/SceneNode.hpp"
 #include "lighting/Light.hpp"
 #include "particles/ParticleNode.hpp"
 #include "utils/Image.hpp"
 
-// Use this #define to selectively compile your code to print the
-// debug logs. Uncomment this option to turn it on.
-#define DEBUG_LOGS
-
 using Color = glm::vec3;
 
-// Supersampling size
-const int SAMPLE_SIZE = 8;
+// Default supersampling size
+const int SAMPLE_SIZE = 4;
+
+// How the samples of a pixel are spread over the pixel and the shutter interval
+const SamplerType SAMPLER = SamplerType::Sobol;
+
+// Default standard error of the colour of a pixel adaptive sampling stops at
+const float ADAPTIVE_THRESHOLD = 0.01f;
+
+// Width and height in pixels of the packets primary rays are traced in, 1 traces every
+// primary ray on its own
+const int PACKET_SIZE = 8;
+
+// Default width and height in pixels of the tiles the render threads take from each other
+const int TILE_SIZE = 16;
 
-// Max depth of recursion
+/**
+ * Integrator selects how the rays spawned by primary hits are traced. Recursive follows
+ * each ray depth first, Wavefront traces all rays of a bounce of a packet together,
+ * sorted so rays near each other are traced one after another. Both give the same image.
+ */
+enum class Integrator {
+    Recursive,
+    Wavefront
+};
+
+const Integrator INTEGRATOR = Integrator::Recursive;
+
+// Default max depth of recursion
 const int MAX_DEPTH = 5;
 
+// Most passes progressive rendering takes of a frame, whatever its budget
+const int MAX_PROGRESSIVE_PASSES = 1 << 16;
+
+/**
+ * RenderSettings holds the settings that can change between renders without rebuilding,
+ * set by gr.render and the command line.
+ *
+ * Pixels start with minSamples, and while the standard error of the mean colour of a
+ * pixel or one of its neighbours is above threshold, the pixel doubles its samples, up
+ * to maxSamples. Pixels all take the same number of samples when minSamples equals
+ * maxSamples.
+ *
+ * Setting a time budget or noise target renders progressively instead, one sample of
+ * every pixel per pass, until the frame has taken timeBudget seconds or the estimated
+ * noise of the image is below noiseTarget.
+ *
+ * Of the frames the scene asks for, only the ones in [firstFrame, lastFrame] that belong
+ * to the shard are rendered, so a job can be split across processes and machines without
+ * editing the scene. With workers above 0 the frames are rendered in that many worker
+ * processes instead.
+ */
+struct RenderSettings {
+    int minSamples = SAMPLE_SIZE;
+    int maxSamples = SAMPLE_SIZE;
+    float threshold = ADAPTIVE_THRESHOLD;
+    float timeBudget = 0.0f;  // Seconds per frame, 0 for no limit
+    float noiseTarget = 0.0f; // 0 for no target
+    float checkpoint = 0.0f;  // Seconds between writing progressive images, 0 for never
+    int maxDepth = MAX_DEPTH;
+    unsigned int threads = 0; // 0 uses every hardware thread
+    int tileSize = TILE_SIZE;
+    uint32_t seed = 0;        // Changes the noise of the samples
+    std::string output;       // Replaces the file name given to gr.render if not empty
+    bool logs = true;         // Print the progress and timings of every frame
+    int firstFrame = std::numeric_limits<int>::min();
+    int lastFrame = std::numeric_limits<int>::max();
+    int shard = 0;            // Renders the frames that are shard modulo numShards
+    int numShards = 1;
+    unsigned int workers = 0; // Worker processes, 0 renders in this process
+    std::string report;       // CSV file of the time workers took for each frame
+    std::string serve;        // Address to serve tiles to a coordinator on, if not empty
+    std::vector<std::string> connect; // Addresses of the workers to hand tiles out to
+
+    // Whether a frame, of the frames from startFrame the scene asks for, is rendered
+    [[nodiscard]] bool rendersFrame(const int frame, const int startFrame) const
+    {
+        return frame >= firstFrame && frame <= lastFrame &&
+               (frame - startFrame) % numShards == shard;
+    }
+
+    [[nodiscard]] bool progressive() const
+    {
+        return timeBudget > 0.0f || noiseTarget > 0.0f;
+    }
+};
+
 class RayTracer {
 public:
     RayTracer(
@@ -29,33 +115,77 @@ public:
         const glm::vec3& eye,
         const glm::vec3& ambient,
         const std::list<Light*>& lights,
-        Image* image
+        Image* image,
+        float shutter = 0.0f,
+        const RenderSettings& settings = RenderSettings()
     );
 
-    void preprocessAnimation(SceneNode* node, const float t);
-    void resetAnimation(SceneNode* node);
-    void traverseSceneGraph(
-        const SceneNode* node,
-        Ray ray,
-        Intersection& intersection,
-        glm::mat4 trans,
-        glm::mat4 invTrans
+    void compileScene(float openTime, float closeTime);
+    void intersectScene(const Ray& ray, Intersection& intersection) const;
+    bool intersectInstance(
+        const Ray& ray,
+        uint32_t instanceIndex,
+        Hit& hit,
+        float& tMax
     ) const;
+    void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    bool occluded(const Ray& ray, float tMax) const;
     Color raytrace(Ray& ray, int currDepth) const;
-    void render(
+    Color shade(Ray& ray, const Intersection& intersection, int currDepth) const;
+    void intersectPacket(
+        const std::vector<Ray>& rays,
+        const Frustum& frustum,
+        std::vector<Intersection>& intersections
+    ) const;
+    void traceWavefront(
+        const std::vector<Ray>& rays,
+        const std::vector<Intersection>& intersections,
+        Color* colors
+    ) const;
+    size_t renderTile(
+        Sampler& sampler,
+        int frameNum,
+        int startX,
+        int endX,
+        int startY,
+        int endY
+    ) const;
+    void renderPass(
+        Sampler& sampler,
         int frameNum,
-        int threadNum,
-        int startWidth,
-        int endWidth
+        int sampleIndex,
+        int startX,
+        int endX,
+        int startY,
+        int endY,
+        AccumulationBuffer& accumulation
     ) const;
 
 private:
+    glm::vec3 screenDirection(float x, float y) const;
+    Color background(const Ray& ray) const;
+    Ray modelRay(const Ray& ray, const SceneInstance& instance) const;
+    Frustum packetFrustum(int startX, int endX, int startY, int endY) const;
+    void traceSamples(
+        Sampler& sampler,
+        int frameNum,
+        const Frustum& frustum,
+        const std::vector<glm::ivec2>& pixels,
+        int firstSample,
+        int numSamples,
+        std::vector<Color>& samples
+    ) const;
+
     SceneNode* m_root;
     glm::mat4 m_screenToWorld;
     glm::vec3 m_eye;
     glm::vec3 m_ambient;
     std::list<Light*> m_lights;
     Image* m_image;
+    float m_shutter; // Fraction of a frame the shutter stays open for
+    RenderSettings m_settings;
+    SceneSnapshot m_snapshot;
+    SceneBVH m_sceneBVH;
 };
 
 void A5_Render(
@@ -79,5 +209,11 @@ void A5_Render(
     const std::list<Light*>& lights,
 
     // Particle systems
-    const std::list<ParticleNode*>& particleSpawners
+    const std::list<ParticleNode*>& particleSpawners,
+
+    // Motion blur, as the fraction of a frame the shutter stays open for
+    float shutter = 0.0f,
+
+    // Samples, threads and output of the render
+    const RenderSettings& settings = RenderSettings()
 );
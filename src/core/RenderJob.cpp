@@ -0,0 +1,216 @@
+#include "RenderJob.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "core/Threads.hpp"
+
+// Settings of the coordinator, which are left out of the command line of its workers
+const char* const JOB_SETTINGS[] = {"--workers", "--report", "--frames", "--shard"};
+
+// Command line workers are started with, before the frame they render
+static std::vector<std::string> worker_command;
+
+//---------------------------------------------------------------------------------------
+/**
+ * setWorkerCommand records the command line of this process, which worker processes are
+ * started with, so they load the same scene with the same settings.
+ * @param argc Number of arguments, including the executable
+ * @param argv Arguments, where settings are given as --name value
+ */
+void setWorkerCommand(const int argc, char** argv)
+{
+    worker_command.clear();
+    for (int i = 0; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (std::find(std::begin(JOB_SETTINGS), std::end(JOB_SETTINGS), arg) !=
+            std::end(JOB_SETTINGS))
+        {
+            i++; // Skip the value too
+            continue;
+        }
+        worker_command.push_back(arg);
+    }
+
+    // Workers keep quiet, the coordinator logs for them. Settings on the command line
+    // replace the ones passed to gr.render, so workers render their frame themselves even
+    // when the scene asks for workers
+    worker_command.insert(worker_command.end(),
+                          {"--logs", "false", "--workers", "0", "--report", ""});
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * startWorker starts a worker process rendering a single frame, with its standard output
+ * discarded.
+ * @param frame Frame to render
+ * @param numThreads Render threads of the worker
+ * @return Process id of the worker, or -1 if it could not be started
+ */
+static pid_t startWorker(const int frame, const unsigned int numThreads)
+{
+    std::vector<std::string> args = worker_command;
+    args.emplace_back("--frames");
+    args.push_back(std::to_string(frame) + ":" + std::to_string(frame));
+    args.emplace_back("--threads");
+    args.push_back(std::to_string(numThreads));
+
+    std::vector<char*> argv;
+    for (std::string& arg: args)
+    {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        const int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0)
+        {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * renderFramesInWorkers renders frames in worker processes, keeping numWorkers of them
+ * running until every frame is done. Frames are handed out in order as workers finish,
+ * so slow frames do not hold up the rest.
+ * @param frames Frames to render
+ * @param numWorkers Number of workers running at once, at least 1
+ * @param numThreads Render threads of every worker, 0 to share the hardware threads
+ * between the workers
+ * @param reportPath CSV file to write the time of every frame to, none if empty
+ * @param logs Print every frame as it finishes and a summary of the job
+ * @return True if every frame rendered
+ */
+bool renderFramesInWorkers(
+    const std::vector<int>& frames,
+    const unsigned int numWorkers,
+    const unsigned int numThreads,
+    const std::string& reportPath,
+    const bool logs
+)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Workers each use every hardware thread by default, which would run numWorkers
+    // threads on every core
+    const unsigned int sharedThreads = workerThreadCount() / std::max(1u, numWorkers);
+    const unsigned int workerThreads =
+        numThreads > 0 ? numThreads : std::max(1u, sharedThreads);
+
+    struct FrameRun {
+        int frame;
+        unsigned int worker; // Slot the frame ran in, less than numWorkers
+        Clock::time_point start;
+        double seconds;
+        bool succeeded;
+    };
+
+    const Clock::time_point jobStart = Clock::now();
+    std::vector<FrameRun> runs;
+    std::vector<pid_t> running(std::max(1u, numWorkers), -1);
+    std::vector<size_t> runOfWorker(running.size());
+    size_t numRunning = 0;
+    size_t next = 0;
+    while (next < frames.size() || numRunning > 0)
+    {
+        // Hand out frames to every idle worker
+        for (unsigned int worker = 0; worker < running.size(); worker++)
+        {
+            if (running[worker] != -1 || next == frames.size())
+            {
+                continue;
+            }
+            runs.push_back({frames[next++], worker, Clock::now(), 0.0, false});
+            const pid_t pid = startWorker(runs.back().frame, workerThreads);
+            if (pid < 0)
+            {
+                std::cerr << "Could not start a worker for frame " << runs.back().frame
+                          << std::endl;
+                continue;
+            }
+            running[worker] = pid;
+            runOfWorker[worker] = runs.size() - 1;
+            numRunning++;
+        }
+        if (numRunning == 0)
+        {
+            continue;
+        }
+
+        // Wait for any worker to finish
+        int status = 0;
+        const pid_t pid = waitpid(-1, &status, 0);
+        const auto worker = std::find(running.begin(), running.end(), pid);
+        if (pid < 0 || worker == running.end())
+        {
+            continue;
+        }
+        FrameRun& run = runs[runOfWorker[worker - running.begin()]];
+        run.seconds = std::chrono::duration<double>(Clock::now() - run.start).count();
+        run.succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        *worker = -1;
+        numRunning--;
+
+        if (!run.succeeded)
+        {
+            std::cerr << "Frame " << run.frame << " failed" << std::endl;
+        }
+        else if (logs)
+        {
+            std::cout << " - Rendered frame " << run.frame << " in " << run.seconds
+                      << " s on worker " << run.worker << std::endl;
+        }
+    }
+    const double jobSeconds =
+        std::chrono::duration<double>(Clock::now() - jobStart).count();
+
+    if (!reportPath.empty())
+    {
+        std::ofstream report(reportPath);
+        report << "frame,worker,seconds,status\n";
+        for (const FrameRun& run: runs)
+        {
+            report << run.frame << "," << run.worker << "," << run.seconds << ","
+                   << (run.succeeded ? "ok" : "failed") << "\n";
+        }
+        if (!report)
+        {
+            std::cerr << "Could not write the job report " << reportPath << std::endl;
+        }
+    }
+
+    const auto failed = [](const FrameRun& run) { return !run.succeeded; };
+    const size_t numFailed = std::count_if(runs.begin(), runs.end(), failed);
+    if (logs && !runs.empty())
+    {
+        double total = 0.0;
+        double slowest = 0.0;
+        for (const FrameRun& run: runs)
+        {
+            total += run.seconds;
+            slowest = std::max(slowest, run.seconds);
+        }
+        std::cout << "----- Rendered " << runs.size() - numFailed << " of " << runs.size()
+                  << " frames in " << jobSeconds << " s with " << running.size()
+                  << " workers -----" << std::endl;
+        std::cout << "----- Frames took " << total / runs.size() << " s on average, "
+                  << slowest << " s at most -----" << std::endl;
+    }
+    return numFailed == 0;
+}
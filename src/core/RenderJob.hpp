@@ -0,0 +1,21 @@
+/*
+ * Name: RenderJob
+ * Description: Splits the frames of an animation across worker processes on this machine.
+ * The coordinator starts a copy of the renderer for every frame, runs a given number at
+ * once, and hands the next frame to whichever worker finishes first. The time each frame
+ * took is collected into a report of the job.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+void setWorkerCommand(int argc, char** argv);
+bool renderFramesInWorkers(
+    const std::vector<int>& frames,
+    unsigned int numWorkers,
+    unsigned int numThreads,
+    const std::string& reportPath,
+    bool logs
+);
@@ -0,0 +1,444 @@
+#include "Sampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Largest float below 1, so samples always stay inside [0, 1)
+const float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+// Side length in pixels of the blue noise mask, which is tiled over the image
+const int MASK_SIZE = 64;
+
+// Standard deviation in pixels of the filter void and cluster ranks the mask with
+const float MASK_SIGMA = 1.5f;
+
+// Fractional part of the golden ratio, used to move the mask to new values every frame
+const float GOLDEN_RATIO_FRACTION = 0.618033988749895f;
+
+// Spreads the bits of render seeds, so nearby seeds do not just swap dimensions
+const uint32_t SEED_MULTIPLIER = 0x9e3779b9u;
+
+//---------------------------------------------------------------------------------------
+// Mixes the bits of x so that similar inputs give unrelated outputs
+static uint32_t hashBits(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+//---------------------------------------------------------------------------------------
+// Converts 32 random bits to a float in [0, 1)
+static float bitsToFloat(const uint32_t bits)
+{
+    return std::min(static_cast<float>(bits) * 0x1p-32f, ONE_MINUS_EPSILON);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * permuteIndex finds where i goes in a random permutation of [0, length), without storing
+ * the permutation. From Kensler, "Correlated Multi-Jittered Sampling".
+ * @param i Index to permute, less than length
+ * @param length Number of elements permuted
+ * @param seed Chooses the permutation
+ * @return Permuted index, less than length
+ */
+static uint32_t permuteIndex(uint32_t i, const uint32_t length, const uint32_t seed)
+{
+    uint32_t w = length - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+
+    // Permute within the next power of two, until the index lands inside the length
+    do
+    {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= length);
+
+    return (i + seed) % length;
+}
+
+//---------------------------------------------------------------------------------------
+static uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * sobol computes the first two dimensions of the Sobol sequence, as 32 bit fractions.
+ * The first dimension is the van der Corput sequence, the second has direction numbers
+ * v[k] = v[k - 1] ^ (v[k - 1] >> 1).
+ * @param index Index of the point in the sequence
+ * @return Bits of the point, to be scaled by 2^-32
+ */
+static glm::uvec2 sobol(uint32_t index)
+{
+    glm::uvec2 result(0);
+    uint32_t direction = 0x80000000u;
+    for (int bit = 0; index != 0; bit++, index >>= 1)
+    {
+        if (index & 1)
+        {
+            result.x ^= 0x80000000u >> bit;
+            result.y ^= direction;
+        }
+        direction ^= direction >> 1;
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * owenScramble randomly flips the bits of a fraction, where the flip of each bit depends
+ * on the bits above it, which keeps the stratification of Sobol points. From Burley,
+ * "Practical Hash-based Owen Scrambling".
+ * @param v Bits of the fraction
+ * @param seed Chooses the scramble
+ * @return Scrambled bits
+ */
+static uint32_t owenScramble(uint32_t v, const uint32_t seed)
+{
+    v = reverseBits(v);
+    v ^= v * 0x3d20adeau;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56u;
+    v ^= v * 0x53a22864u;
+    return reverseBits(v);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * buildBlueNoiseMask ranks the pixels of a tile with the void and cluster method, so that
+ * thresholding the ranks at any level gives evenly spread pixels. Pixels are added one
+ * at a time where the filtered density of the pixels so far is lowest. From Ulichney,
+ * "The void-and-cluster method for dither array generation".
+ * @return Rank of every pixel, row by row, scaled to [0, 1)
+ */
+static std::vector<float> buildBlueNoiseMask()
+{
+    const int numPixels = MASK_SIZE * MASK_SIZE;
+
+    // Filter weight between two pixels by their offset, wrapping around the tile
+    std::vector<float> kernel(numPixels);
+    for (int y = 0; y < MASK_SIZE; y++)
+    {
+        for (int x = 0; x < MASK_SIZE; x++)
+        {
+            const int dx = std::min(x, MASK_SIZE - x);
+            const int dy = std::min(y, MASK_SIZE - y);
+            const auto distanceSquared = static_cast<float>(dx * dx + dy * dy);
+            kernel[y * MASK_SIZE + x] =
+                std::exp(-distanceSquared / (2.0f * MASK_SIGMA * MASK_SIGMA));
+        }
+    }
+
+    std::vector<float> energy(numPixels, 0.0f);
+    std::vector<bool> set(numPixels, false);
+    auto addEnergy = [&](const int pixel, const float sign) {
+        const int px = pixel % MASK_SIZE;
+        const int py = pixel / MASK_SIZE;
+        for (int y = 0; y < MASK_SIZE; y++)
+        {
+            const int ky = (y - py + MASK_SIZE) % MASK_SIZE;
+            for (int x = 0; x < MASK_SIZE; x++)
+            {
+                const int kx = (x - px + MASK_SIZE) % MASK_SIZE;
+                energy[y * MASK_SIZE + x] += sign * kernel[ky * MASK_SIZE + kx];
+            }
+        }
+    };
+
+    // Find the unset pixel with the lowest energy (the largest void) or the set pixel with
+    // the highest (the tightest cluster)
+    auto findExtreme = [&](const bool findSet) {
+        int best = -1;
+        for (int i = 0; i < numPixels; i++)
+        {
+            if (set[i] != findSet)
+            {
+                continue;
+            }
+            if (best < 0 || (findSet ? energy[i] > energy[best] : energy[i] < energy[best]))
+            {
+                best = i;
+            }
+        }
+        return best;
+    };
+
+    // Start from a tenth of the pixels picked at random, then move pixels from the tightest
+    // cluster to the largest void until that no longer changes anything
+    const int initialCount = numPixels / 10;
+    for (int k = 0; k < initialCount; k++)
+    {
+        int pixel = static_cast<int>(hashBits(k) % numPixels);
+        while (set[pixel])
+        {
+            pixel = (pixel + 1) % numPixels;
+        }
+        set[pixel] = true;
+        addEnergy(pixel, 1.0f);
+    }
+
+    while (true)
+    {
+        const int cluster = findExtreme(true);
+        set[cluster] = false;
+        addEnergy(cluster, -1.0f);
+
+        const int gap = findExtreme(false);
+        set[gap] = true;
+        addEnergy(gap, 1.0f);
+        if (gap == cluster)
+        {
+            break;
+        }
+    }
+
+    // Rank the initial pixels by removing them from the tightest cluster down, then the
+    // rest by filling the largest void up
+    std::vector<int> rank(numPixels, 0);
+    const std::vector<bool> initialSet = set;
+    const std::vector<float> initialEnergy = energy;
+    for (int r = initialCount - 1; r >= 0; r--)
+    {
+        const int cluster = findExtreme(true);
+        rank[cluster] = r;
+        set[cluster] = false;
+        addEnergy(cluster, -1.0f);
+    }
+
+    set = initialSet;
+    energy = initialEnergy;
+    for (int r = initialCount; r < numPixels; r++)
+    {
+        const int gap = findExtreme(false);
+        rank[gap] = r;
+        set[gap] = true;
+        addEnergy(gap, 1.0f);
+    }
+
+    std::vector<float> mask(numPixels);
+    for (int i = 0; i < numPixels; i++)
+    {
+        mask[i] = (static_cast<float>(rank[i]) + 0.5f) / static_cast<float>(numPixels);
+    }
+    return mask;
+}
+
+//---------------------------------------------------------------------------------------
+Sampler::Sampler(const int samplesPerPixel, const uint32_t seed)
+    : m_samplesPerPixel(samplesPerPixel),
+      m_seed(seed * SEED_MULTIPLIER),
+      m_pixel(0)
+{}
+
+//---------------------------------------------------------------------------------------
+Sampler::~Sampler()
+{}
+
+//---------------------------------------------------------------------------------------
+/**
+ * startPixelSample prepares the sampler for a sample of a pixel, starting at its first
+ * dimension.
+ * @param pixel Pixel the sample belongs to
+ * @param frame Frame being rendered
+ * @param sampleIndex Index of the sample within the pixel, less than samplesPerPixel for
+ * stratified samplers
+ */
+void Sampler::startPixelSample(
+    const glm::ivec2& pixel,
+    const int frame,
+    const int sampleIndex
+)
+{
+    m_pixel = pixel;
+    m_frame = frame;
+    m_sampleIndex = sampleIndex;
+    m_dimension = 0;
+}
+
+//---------------------------------------------------------------------------------------
+// Seed shared by every sample of the current pixel and frame in the given dimension
+uint32_t Sampler::dimensionSeed(const uint32_t dimension) const
+{
+    uint32_t seed = hashBits(dimension ^ m_seed);
+    seed = hashBits(seed ^ static_cast<uint32_t>(m_frame));
+    seed = hashBits(seed ^ static_cast<uint32_t>(m_pixel.y));
+    return hashBits(seed ^ static_cast<uint32_t>(m_pixel.x));
+}
+
+//---------------------------------------------------------------------------------------
+float RandomSampler::get1D()
+{
+    const uint32_t seed = dimensionSeed(m_dimension++);
+    return bitsToFloat(hashBits(seed + static_cast<uint32_t>(m_sampleIndex)));
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec2 RandomSampler::get2D()
+{
+    return {get1D(), get1D()};
+}
+
+//---------------------------------------------------------------------------------------
+StratifiedSampler::StratifiedSampler(const int samplesPerPixel, const uint32_t seed)
+    : Sampler(samplesPerPixel, seed)
+{
+    // Split the square into the grid of strata closest to square
+    m_rows = static_cast<int>(std::sqrt(static_cast<float>(samplesPerPixel)));
+    while (samplesPerPixel % m_rows != 0)
+    {
+        m_rows--;
+    }
+    m_columns = samplesPerPixel / m_rows;
+}
+
+//---------------------------------------------------------------------------------------
+// Each sample of a pixel falls in its own stratum of the dimension, and the strata are
+// shuffled differently in every dimension so the dimensions are not correlated
+float StratifiedSampler::get1D()
+{
+    const uint32_t seed = dimensionSeed(m_dimension++);
+    const uint32_t stratum = permuteIndex(m_sampleIndex, m_samplesPerPixel, seed);
+    const float jitter = bitsToFloat(hashBits(seed ^ hashBits(m_sampleIndex)));
+    return (static_cast<float>(stratum) + jitter) / static_cast<float>(m_samplesPerPixel);
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec2 StratifiedSampler::get2D()
+{
+    const uint32_t seed = dimensionSeed(m_dimension);
+    m_dimension += 2;
+
+    const uint32_t stratum = permuteIndex(m_sampleIndex, m_samplesPerPixel, seed);
+    const uint32_t jitterBits = hashBits(seed ^ hashBits(m_sampleIndex));
+    const glm::vec2 jitter(bitsToFloat(jitterBits), bitsToFloat(hashBits(jitterBits)));
+    return {(static_cast<float>(stratum % m_columns) + jitter.x) / m_columns,
+            (static_cast<float>(stratum / m_columns) + jitter.y) / m_rows};
+}
+
+//---------------------------------------------------------------------------------------
+// Every dimension is drawn from its own scrambled one or two dimensional Sobol sequence,
+// with the samples shuffled so the dimensions are not correlated. Owen scrambling the
+// index only shuffles it within aligned blocks of every power of two, so the first
+// 2^m samples of a pixel are always a whole block, stratified however many are taken
+float SobolSampler::get1D()
+{
+    const uint32_t seed = dimensionSeed(m_dimension++);
+    const uint32_t index = owenScramble(m_sampleIndex, seed);
+    return bitsToFloat(owenScramble(sobol(index).x, hashBits(seed)));
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec2 SobolSampler::get2D()
+{
+    const uint32_t seed = dimensionSeed(m_dimension);
+    m_dimension += 2;
+
+    const uint32_t index = owenScramble(m_sampleIndex, seed);
+    const glm::uvec2 bits = sobol(index);
+    return {bitsToFloat(owenScramble(bits.x, hashBits(seed ^ 0x1u))),
+            bitsToFloat(owenScramble(bits.y, hashBits(seed ^ 0x2u)))};
+}
+
+//---------------------------------------------------------------------------------------
+// Reads the blue noise mask at the pixel, from a different place of the tile for every
+// seed, and moves it on every frame
+float BlueNoiseSampler::maskOffset(const uint32_t seed) const
+{
+    static const std::vector<float> mask = buildBlueNoiseMask();
+
+    const uint32_t shift = hashBits(seed);
+    const int x = (m_pixel.x + static_cast<int>(shift % MASK_SIZE)) % MASK_SIZE;
+    const int y = (m_pixel.y + static_cast<int>((shift >> 8) % MASK_SIZE)) % MASK_SIZE;
+    const float offset = mask[y * MASK_SIZE + x] + GOLDEN_RATIO_FRACTION * m_frame;
+    return offset - std::floor(offset);
+}
+
+//---------------------------------------------------------------------------------------
+// The same Sobol points are used for every pixel, shifted by the blue noise mask, so the
+// shift and hence the error varies like blue noise across the image. The samples are
+// shuffled the same way in every pixel to not break that up
+float BlueNoiseSampler::get1D()
+{
+    const uint32_t dimension = m_dimension++ ^ m_seed;
+    const uint32_t shuffle = hashBits(dimension);
+    const uint32_t index = owenScramble(m_sampleIndex, shuffle);
+    const float value = bitsToFloat(sobol(index).x) + maskOffset(dimension);
+    return std::min(value - std::floor(value), ONE_MINUS_EPSILON);
+}
+
+//---------------------------------------------------------------------------------------
+glm::vec2 BlueNoiseSampler::get2D()
+{
+    const uint32_t dimension = m_dimension ^ m_seed;
+    m_dimension += 2;
+
+    const uint32_t shuffle = hashBits(dimension);
+    const uint32_t index = owenScramble(m_sampleIndex, shuffle);
+    const glm::uvec2 bits = sobol(index);
+    const glm::vec2 value = glm::vec2(bitsToFloat(bits.x) + maskOffset(dimension),
+                                      bitsToFloat(bits.y) + maskOffset(dimension ^ 1u));
+    return glm::min(value - glm::floor(value), glm::vec2(ONE_MINUS_EPSILON));
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * createSampler creates a sampler of the given type, which is owned by the caller and
+ * should only be used by a single thread.
+ * @param type Type of the sampler
+ * @param samplesPerPixel Number of samples taken in each pixel
+ * @param seed Changes the points of every sample, 0 is the default
+ * @return New sampler
+ */
+std::unique_ptr<Sampler> createSampler(
+    const SamplerType type,
+    const int samplesPerPixel,
+    const uint32_t seed
+)
+{
+    switch (type)
+    {
+        case SamplerType::Stratified:
+            return std::make_unique<StratifiedSampler>(samplesPerPixel, seed);
+        case SamplerType::Sobol:
+            return std::make_unique<SobolSampler>(samplesPerPixel, seed);
+        case SamplerType::BlueNoise:
+            return std::make_unique<BlueNoiseSampler>(samplesPerPixel, seed);
+        case SamplerType::Random:
+        default:
+            return std::make_unique<RandomSampler>(samplesPerPixel, seed);
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * Name: Sampler
+ * Description: Samplers choose the points within a pixel and within the shutter interval
+ * that each sample of the pixel is traced at. Every render thread owns its own sampler,
+ * and the points only depend on the pixel, frame and sample index, so images come out
+ * the same however the work is split between threads.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include <glm/glm.hpp>
+
+/**
+ * SamplerType selects how samples are spread. Random picks every point independently,
+ * Stratified jitters the points within a grid of strata, Sobol uses an Owen scrambled
+ * Sobol sequence, and BlueNoise shifts an unscrambled Sobol sequence by a blue noise
+ * mask so the error left in neighbouring pixels is not alike.
+ */
+enum class SamplerType {
+    Random,
+    Stratified,
+    Sobol,
+    BlueNoise
+};
+
+/**
+ * Sampler is the interface of all samplers. Each sample starts with startPixelSample, and
+ * then every call to get1D or get2D takes the next dimensions of the sample.
+ */
+class Sampler {
+public:
+    explicit Sampler(int samplesPerPixel, uint32_t seed = 0);
+    virtual ~Sampler();
+
+    void startPixelSample(const glm::ivec2& pixel, int frame, int sampleIndex);
+    virtual float get1D() = 0;
+    virtual glm::vec2 get2D() = 0;
+
+protected:
+    [[nodiscard]] uint32_t dimensionSeed(uint32_t dimension) const;
+
+    int m_samplesPerPixel;
+    uint32_t m_seed;
+    glm::ivec2 m_pixel;
+    int m_frame = 0;
+    int m_sampleIndex = 0;
+    uint32_t m_dimension = 0; // Next dimension of the sample
+};
+
+//---------------------------------------------------------------------------------------
+class RandomSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+    glm::vec2 get2D() override;
+};
+
+//---------------------------------------------------------------------------------------
+class StratifiedSampler : public Sampler {
+public:
+    explicit StratifiedSampler(int samplesPerPixel, uint32_t seed = 0);
+
+    float get1D() override;
+    glm::vec2 get2D() override;
+
+private:
+    int m_columns; // Strata across the square, m_rows * m_columns == m_samplesPerPixel
+    int m_rows;
+};
+
+//---------------------------------------------------------------------------------------
+class SobolSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+    glm::vec2 get2D() override;
+};
+
+//---------------------------------------------------------------------------------------
+class BlueNoiseSampler : public Sampler {
+public:
+    using Sampler::Sampler;
+
+    float get1D() override;
+    glm::vec2 get2D() override;
+
+private:
+    [[nodiscard]] float maskOffset(uint32_t seed) const;
+};
+
+std::unique_ptr<Sampler> createSampler(
+    SamplerType type,
+    int samplesPerPixel,
+    uint32_t seed = 0
+);
@@ -0,0 +1,172 @@
+#include "SceneSnapshot.hpp"
+
+#include <algorithm>
+
+// Relative amount world space boxes are padded by to absorb rounding in the transforms
+const float BOUNDS_PADDING = 1e-4f;
+
+//---------------------------------------------------------------------------------------
+/**
+ * worldBounds transforms a box in model coordinates to world coordinates, padded to
+ * absorb rounding in the transforms.
+ * @param modelBounds Box in model coordinates
+ * @param trans Model to world transformation
+ * @return Box in world coordinates
+ */
+static AABB worldBounds(const AABB& modelBounds, const glm::mat4& trans)
+{
+    AABB result = modelBounds.transformed(trans);
+    const glm::vec3 padding = BOUNDS_PADDING * (result.extent() + glm::vec3(1.0f));
+    result.min -= padding;
+    result.max += padding;
+    return result;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * transformsAt interpolates the transformations of the instance within the shutter
+ * interval. Matrices are interpolated linearly, which is exact for translations and
+ * close enough for the small rotations of a single frame. The inverses are interpolated
+ * the same way between the inverses baked at both ends, so no matrix is inverted per ray.
+ * @param s Fraction of the shutter interval, from 0 (open) to 1 (close)
+ * @param movedTrans Set to the model to world transformation
+ * @param movedInvTrans Set to the world to model transformation
+ * @param movedNormalTrans Set to the model to world transformation of normals
+ */
+void SceneInstance::transformsAt(
+    const float s,
+    glm::mat4& movedTrans,
+    glm::mat4& movedInvTrans,
+    glm::mat3& movedNormalTrans
+) const
+{
+    movedTrans = trans + s * (closeTrans - trans);
+    movedInvTrans = invTransAt(s);
+    movedNormalTrans = glm::mat3(glm::transpose(movedInvTrans));
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * invTransAt interpolates only the world to model transformation of the instance, which
+ * is all that placing a ray in model coordinates needs.
+ * @param s Fraction of the shutter interval, from 0 (open) to 1 (close)
+ * @return World to model transformation
+ */
+glm::mat4 SceneInstance::invTransAt(const float s) const
+{
+    return invTrans + s * (closeInvTrans - invTrans);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * compile flattens the scene graph under root into instances, with the animations of
+ * the nodes and lights applied for shutter open, and the transformations of moving
+ * instances for shutter close. The scene graph and lights are left untouched.
+ * @param root Root of the scene graph
+ * @param lights Lights of the scene
+ * @param openTime Frame time the shutter opens at
+ * @param closeTime Frame time the shutter closes at, equal to openTime without blur
+ */
+void SceneSnapshot::compile(
+    const SceneNode* root,
+    const std::list<Light*>& lights,
+    const float openTime,
+    const float closeTime
+)
+{
+    m_instances.clear();
+    m_frameNodes.clear();
+    m_framePrimitives.clear();
+    m_openTime = openTime;
+    m_closeTime = closeTime;
+    m_hasMotion = false;
+    addInstances(root, glm::mat4(), glm::mat4(), glm::mat4(), glm::mat4());
+
+    m_lights.clear();
+    for (const Light* light: lights)
+    {
+        m_lights.push_back(*light);
+        m_lights.back().m_position = light->positionAt(openTime);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * shutterFraction converts the time of a ray to a fraction of the shutter interval.
+ * @param t Frame time of the ray
+ * @return Fraction from 0 (open) to 1 (close)
+ */
+float SceneSnapshot::shutterFraction(const float t) const
+{
+    if (m_closeTime <= m_openTime)
+    {
+        return 0.0f;
+    }
+    return std::clamp((t - m_openTime) / (m_closeTime - m_openTime), 0.0f, 1.0f);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * addInstances recursively traverses the scene graph, passing hierarchical
+ * transformations down the tree, and adds an instance for each node with geometry.
+ * @param node Current node of the scene graph
+ * @param trans Transformations of the ancestors of node at shutter open
+ * @param invTrans Inverse transformations of the ancestors of node at shutter open
+ * @param closeTrans Transformations of the ancestors of node at shutter close
+ * @param closeInvTrans Inverse transformations of the ancestors of node at shutter close
+ */
+void SceneSnapshot::addInstances(
+    const SceneNode* node,
+    glm::mat4 trans,
+    glm::mat4 invTrans,
+    glm::mat4 closeTrans,
+    glm::mat4 closeInvTrans
+)
+{
+    // Add transformations of the current node as we go "down" the tree
+    glm::mat4 nodeTrans;
+    glm::mat4 nodeInvTrans;
+    node->transformsAt(m_openTime, nodeTrans, nodeInvTrans);
+    trans = trans * nodeTrans;
+    invTrans = nodeInvTrans * invTrans;
+    if (m_closeTime > m_openTime)
+    {
+        node->transformsAt(m_closeTime, nodeTrans, nodeInvTrans);
+    }
+    closeTrans = closeTrans * nodeTrans;
+    closeInvTrans = nodeInvTrans * closeInvTrans;
+
+    // Trace the copy of the node for this frame if its geometry changes between frames
+    const SceneNode* geometry = node;
+    if (std::unique_ptr<SceneNode> frameNode = node->atTime(m_openTime, m_framePrimitives))
+    {
+        geometry = frameNode.get();
+        m_frameNodes.push_back(std::move(frameNode));
+    }
+
+    // Nodes without geometry have empty bounds and can never be hit. Primitives move in
+    // straight lines, so their boxes at both ends of the shutter interval cover them
+    AABB modelBounds = geometry->bounds(m_openTime);
+    if (m_closeTime > m_openTime)
+    {
+        modelBounds.extend(geometry->bounds(m_closeTime));
+    }
+
+    if (!modelBounds.isEmpty())
+    {
+        // Normals transform by the inverse transpose, which we already have the inverse of
+        const glm::mat3 normalTrans = glm::mat3(glm::transpose(invTrans));
+        const AABB bounds = worldBounds(modelBounds, trans);
+        const AABB closeBounds = worldBounds(modelBounds, closeTrans);
+        const bool moving = closeTrans != trans;
+        m_hasMotion |= moving;
+
+        m_instances.push_back({geometry, trans, invTrans, normalTrans, bounds, modelBounds,
+                               closeTrans, closeInvTrans, closeBounds, moving});
+    }
+
+    for (const SceneNode* child: node->children)
+    {
+        addInstances(child, trans, invTrans, closeTrans, closeInvTrans);
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Name: SceneSnapshot
+ * Description: Flattened copy of the scene graph for a single frame. Compiling the
+ * snapshot bakes the hierarchical transformations of every node with geometry, so rays
+ * do not need to combine or invert matrices while they are traced. For motion blur the
+ * transformations are baked at both ends of the shutter interval and interpolated.
+ * Animations are evaluated without changing the scene graph: the snapshot keeps its own
+ * copies of the lights and of the geometry that changes between frames, so snapshots of
+ * several frames can be traced at once.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "acceleration/AABB.hpp"
+#include "geometry/SceneNode.hpp"
+#include "lighting/Light.hpp"
+
+/**
+ * SceneInstance is a node of the scene graph that holds geometry, together with the
+ * world transformations of its model coordinates for this frame. The transformations
+ * are those at shutter open, and are interpolated towards closeTrans if moving is set.
+ */
+struct SceneInstance {
+    const SceneNode* node;   // Node of the scene graph, or its copy for this frame
+    glm::mat4 trans;         // Model to world coordinates
+    glm::mat4 invTrans;      // World to model coordinates
+    glm::mat3 normalTrans;   // Model to world coordinates for normals
+    AABB bounds;             // Bounding box in world coordinates
+    AABB modelBounds;        // Bounding box in model coordinates over the shutter interval
+    glm::mat4 closeTrans;    // Model to world coordinates at shutter close
+    glm::mat4 closeInvTrans; // World to model coordinates at shutter close
+    AABB closeBounds;        // Bounding box in world coordinates at shutter close
+    bool moving;             // Whether the transformations change while the shutter is open
+
+    void transformsAt(
+        float s,
+        glm::mat4& movedTrans,
+        glm::mat4& movedInvTrans,
+        glm::mat3& movedNormalTrans
+    ) const;
+    [[nodiscard]] glm::mat4 invTransAt(float s) const;
+};
+
+/**
+ * SceneSnapshot class holds the instances of a scene graph in a contiguous array.
+ */
+class SceneSnapshot {
+public:
+    void compile(
+        const SceneNode* root,
+        const std::list<Light*>& lights,
+        float openTime,
+        float closeTime
+    );
+
+    [[nodiscard]] const std::vector<SceneInstance>& instances() const { return m_instances; }
+    [[nodiscard]] const std::vector<Light>& lights() const { return m_lights; }
+    [[nodiscard]] bool hasMotion() const { return m_hasMotion; }
+    [[nodiscard]] float shutterFraction(float t) const;
+
+private:
+    void addInstances(
+        const SceneNode* node,
+        glm::mat4 trans,
+        glm::mat4 invTrans,
+        glm::mat4 closeTrans,
+        glm::mat4 closeInvTrans
+    );
+
+    std::vector<SceneInstance> m_instances;
+    std::vector<Light> m_lights; // Lights at shutter open
+    std::vector<std::unique_ptr<SceneNode>> m_frameNodes; // Nodes copied for this frame
+    FramePrimitives m_framePrimitives; // Primitives copied for this frame
+    float m_openTime = 0.0f;
+    float m_closeTime = 0.0f;
+    bool m_hasMotion = false;
+};
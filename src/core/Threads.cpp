@@ -0,0 +1,177 @@
+#include "Threads.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+// Threads set by the threads render setting, 0 for every hardware thread
+static std::atomic<unsigned int> worker_thread_count(0);
+
+//---------------------------------------------------------------------------------------
+/**
+ * setWorkerThreadCount sets the number of threads every later render and hierarchy build
+ * splits its work across.
+ * @param numThreads Number of threads, 0 for every hardware thread
+ */
+void setWorkerThreadCount(const unsigned int numThreads)
+{
+    worker_thread_count = numThreads;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * workerThreadCount computes the number of threads to split work across, which is the
+ * number set by setWorkerThreadCount, or else the number of hardware threads.
+ * @return Number of threads, at least 1
+ */
+unsigned int workerThreadCount()
+{
+    if (const unsigned int numThreads = worker_thread_count; numThreads > 0)
+    {
+        return numThreads;
+    }
+
+    // hardware_concurrency may return 0 if it cannot be determined
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * Constructor for ThreadPool, starts the threads of every worker but the first, which is
+ * the thread calling run.
+ * @param numWorkers Number of workers, at least 1
+ */
+ThreadPool::ThreadPool(const unsigned int numWorkers)
+{
+    for (unsigned int i = 0; i < std::max(1u, numWorkers); i++)
+    {
+        m_queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (unsigned int i = 1; i < m_queues.size(); i++)
+    {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_batchStarted.notify_all();
+
+    for (std::thread& thread: m_threads)
+    {
+        thread.join();
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * run calls task for every task index in [0, numTasks) across the workers, and returns
+ * once all of them are done. Workers are dealt neighbouring tasks in equal blocks to
+ * start with, and rebalance by stealing.
+ * @param numTasks Number of tasks
+ * @param task Callable with the task index and the index of the worker running it,
+ * which no other task runs on at the same time
+ */
+void ThreadPool::run(const uint32_t numTasks, const Task& task)
+{
+    const auto numWorkers = static_cast<uint32_t>(m_queues.size());
+    for (uint32_t i = 0; i < numWorkers; i++)
+    {
+        std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+        for (uint32_t t = numTasks * i / numWorkers; t < numTasks * (i + 1) / numWorkers; t++)
+        {
+            m_queues[i]->tasks.push_back(t);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_busyThreads = static_cast<unsigned int>(m_threads.size());
+        m_batch++;
+    }
+    m_batchStarted.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_batchFinished.wait(lock, [&]() { return m_busyThreads == 0; });
+    m_task = nullptr;
+}
+
+//---------------------------------------------------------------------------------------
+// Waits for batches of tasks and works on each until no task is left to take
+void ThreadPool::workerLoop(const unsigned int worker)
+{
+    uint64_t batch = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_batchStarted.wait(lock, [&]() { return m_stopping || m_batch != batch; });
+            if (m_stopping)
+            {
+                return;
+            }
+            batch = m_batch;
+        }
+
+        runTasks(worker);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyThreads == 0)
+        {
+            m_batchFinished.notify_one();
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Runs tasks of the current batch on a worker until there are none left to take
+void ThreadPool::runTasks(const unsigned int worker)
+{
+    uint32_t task;
+    while (takeTask(worker, task))
+    {
+        (*m_task)(task, worker);
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * takeTask takes the next task of a worker, from the front of its own deque or else from
+ * the back of another worker's.
+ * @param worker Index of the worker
+ * @param task Set to the task taken
+ * @return False if every deque is empty
+ */
+bool ThreadPool::takeTask(const unsigned int worker, uint32_t& task)
+{
+    {
+        TaskQueue& own = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    for (size_t k = 1; k < m_queues.size(); k++)
+    {
+        TaskQueue& victim = *m_queues[(worker + k) % m_queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+/*
+ * Name: Threads
+ * Description: Decides how many threads the renderer uses, both to render frames and
+ * to build bounding volume hierarchies, and keeps a pool of threads alive between
+ * frames that balances the tiles of a frame across them.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void setWorkerThreadCount(unsigned int numThreads);
+unsigned int workerThreadCount();
+
+/**
+ * ThreadPool runs batches of tasks on a set of threads that live as long as the pool.
+ * Every worker owns a deque of tasks. It takes tasks from the front of its own deque, and
+ * once that is empty, steals from the back of the others, so workers that were dealt
+ * cheap tasks help out the ones left with expensive tasks. The thread calling run works
+ * as worker 0.
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void(uint32_t task, unsigned int worker)>;
+
+    explicit ThreadPool(unsigned int numWorkers = workerThreadCount());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    [[nodiscard]] unsigned int size() const
+    {
+        return static_cast<unsigned int>(m_queues.size());
+    }
+    void run(uint32_t numTasks, const Task& task);
+
+private:
+    // Tasks dealt to a worker, which other workers may steal from
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    void workerLoop(unsigned int worker);
+    void runTasks(unsigned int worker);
+    bool takeTask(unsigned int worker, uint32_t& task);
+
+    std::vector<std::unique_ptr<TaskQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex; // Guards everything below
+    std::condition_variable m_batchStarted;
+    std::condition_variable m_batchFinished;
+    const Task* m_task = nullptr;
+    uint64_t m_batch = 0; // Number of batches started, so workers notice new ones
+    unsigned int m_busyThreads = 0; // Threads of m_threads still working on the batch
+    bool m_stopping = false;
+};
@@ -0,0 +1,564 @@
+#include "TileNetwork.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// First message of a worker, followed by the width and height of its image
+const uint32_t HELLO_MAGIC = 0x31575452;
+
+// Requests the coordinator keeps queued at each worker, so a worker can start on the next
+// rectangle while the last one is sent back
+const size_t REQUESTS_IN_FLIGHT = 2;
+
+// Seconds the coordinator waits on a worker before giving its rectangles to the others,
+// which has to cover rendering REQUESTS_IN_FLIGHT rectangles. Workers wait this long for
+// the coordinator to take their replies
+const int REPLY_TIMEOUT_SECONDS = 120;
+
+// Number of 32-bit words a TileRect is sent as
+const size_t TILE_WORDS = 5;
+
+// Broken connections should fail the send instead of killing the process
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+//---------------------------------------------------------------------------------------
+/**
+ * openSocket opens a listening socket, or connects to one.
+ * @param address "host:port" for TCP, where servers may leave out the host to listen on
+ * every interface, or "unix:path" for a Unix socket
+ * @param server Listen on the address instead of connecting to it
+ * @return Socket, or -1 if it could not be opened
+ */
+static int openSocket(const std::string& address, const bool server)
+{
+    if (address.rfind("unix:", 0) == 0)
+    {
+        const std::string path = address.substr(5);
+        sockaddr_un unixAddress = {};
+        unixAddress.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(unixAddress.sun_path))
+        {
+            return -1;
+        }
+        std::strncpy(unixAddress.sun_path, path.c_str(), sizeof(unixAddress.sun_path) - 1);
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        const sockaddr* socketAddress = reinterpret_cast<const sockaddr*>(&unixAddress);
+        bool opened = fd >= 0;
+        if (opened && server)
+        {
+            unlink(path.c_str());
+            opened = bind(fd, socketAddress, sizeof(unixAddress)) == 0 &&
+                     listen(fd, 16) == 0;
+        }
+        else if (opened)
+        {
+            opened = ::connect(fd, socketAddress, sizeof(unixAddress)) == 0;
+        }
+        if (!opened && fd >= 0)
+        {
+            close(fd);
+        }
+        return opened ? fd : -1;
+    }
+
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+    {
+        return -1;
+    }
+    const std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results))
+    {
+        return -1;
+    }
+
+    // Take the first of the addresses the host resolves to that works
+    int fd = -1;
+    for (addrinfo* result = results; result != nullptr && fd < 0; result = result->ai_next)
+    {
+        fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        const int enable = 1;
+        bool opened;
+        if (server)
+        {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            opened = bind(fd, result->ai_addr, result->ai_addrlen) == 0 &&
+                     listen(fd, 16) == 0;
+        }
+        else
+        {
+            opened = ::connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        }
+        if (!opened)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+//---------------------------------------------------------------------------------------
+// Send all of the bytes, returns false if the connection broke
+static bool sendAll(const int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0)
+    {
+        const ssize_t sent = send(fd, bytes, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Receive exactly size bytes, returns false if the connection broke or closed
+static bool receiveAll(const int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received <= 0)
+        {
+            return false;
+        }
+        bytes += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * watchConnection makes a connection fail instead of blocking forever on a peer that
+ * stopped answering. Keepalive probes notice hosts that went away, and sends, or receives
+ * too if given, time out.
+ * @param fd Connected socket
+ * @param receiveTimeout Also time out receives
+ */
+static void watchConnection(const int fd, const bool receiveTimeout)
+{
+    const int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+
+    timeval timeout = {};
+    timeout.tv_sec = REPLY_TIMEOUT_SECONDS;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (receiveTimeout)
+    {
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Send a rectangle as big-endian words, returns false if the connection broke
+static bool sendTile(const int fd, const TileRect& tile)
+{
+    const int32_t fields[TILE_WORDS] = {tile.frame, tile.startX, tile.endX, tile.startY,
+                                        tile.endY};
+    uint32_t words[TILE_WORDS];
+    for (size_t i = 0; i < TILE_WORDS; i++)
+    {
+        words[i] = htonl(static_cast<uint32_t>(fields[i]));
+    }
+    return sendAll(fd, words, sizeof(words));
+}
+
+//---------------------------------------------------------------------------------------
+// Receive a rectangle sent by sendTile, returns false if the connection broke or closed
+static bool receiveTile(const int fd, TileRect& tile)
+{
+    uint32_t words[TILE_WORDS];
+    if (!receiveAll(fd, words, sizeof(words)))
+    {
+        return false;
+    }
+    int32_t fields[TILE_WORDS];
+    for (size_t i = 0; i < TILE_WORDS; i++)
+    {
+        fields[i] = static_cast<int32_t>(ntohl(words[i]));
+    }
+    tile = {fields[0], fields[1], fields[2], fields[3], fields[4]};
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Big-endian word with the bits of a float
+static uint32_t encodeFloat(const float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return htonl(bits);
+}
+
+//---------------------------------------------------------------------------------------
+// Float with the bits of a word written by encodeFloat
+static float decodeFloat(const uint32_t word)
+{
+    const uint32_t bits = ntohl(word);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//---------------------------------------------------------------------------------------
+// Number of floats in the reply to a request
+static size_t tileFloats(const TileRect& tile)
+{
+    return static_cast<size_t>(tile.endX - tile.startX) * (tile.endY - tile.startY) * 3;
+}
+
+//---------------------------------------------------------------------------------------
+TileServer::TileServer(const std::string& address)
+    : m_address(address)
+{
+    m_listener = openSocket(address, true);
+    if (m_listener < 0)
+    {
+        std::cerr << "Could not listen on " << address << std::endl;
+    }
+}
+
+//---------------------------------------------------------------------------------------
+TileServer::~TileServer()
+{
+    if (m_connection >= 0)
+    {
+        close(m_connection);
+    }
+    if (m_listener >= 0)
+    {
+        close(m_listener);
+        if (m_address.rfind("unix:", 0) == 0)
+        {
+            unlink(m_address.substr(5).c_str());
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * accept waits for a coordinator to connect, and tells it the size of the image.
+ * @return True if a coordinator connected
+ */
+bool TileServer::accept(const uint32_t width, const uint32_t height)
+{
+    if (m_listener < 0)
+    {
+        return false;
+    }
+
+    do
+    {
+        m_connection = ::accept(m_listener, nullptr, nullptr);
+    } while (m_connection < 0 && errno == EINTR);
+    if (m_connection < 0)
+    {
+        return false;
+    }
+
+    // The coordinator may take long to set up the next frame, so only sends time out
+    const int enable = 1;
+    setsockopt(m_connection, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    watchConnection(m_connection, false);
+    const uint32_t hello[3] = {htonl(HELLO_MAGIC), htonl(width), htonl(height)};
+    return sendAll(m_connection, hello, sizeof(hello));
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * serveFrame renders the rectangles of a frame the coordinator asks for and sends them
+ * back, until it asks for a later frame.
+ * @param frame Frame the scene is set up for
+ * @param render Renders a rectangle of the frame into the image
+ * @param image Image the rectangles are rendered into
+ * @return False once the coordinator is done, or asked for an earlier frame
+ */
+bool TileServer::serveFrame(
+    const int frame,
+    const std::function<void(const TileRect&)>& render,
+    const Image& image
+)
+{
+    std::vector<uint32_t> pixels;
+    while (true)
+    {
+        TileRect tile = m_pending;
+        if (!m_hasPending && !receiveTile(m_connection, tile))
+        {
+            return false;
+        }
+        m_hasPending = false;
+
+        if (tile.frame != frame)
+        {
+            // Keep requests for later frames until the scene is set up for them
+            m_hasPending = tile.frame > frame;
+            m_pending = tile;
+            if (!m_hasPending)
+            {
+                std::cerr << "Coordinator asked for frame " << tile.frame << " after frame "
+                          << frame << std::endl;
+            }
+            return m_hasPending;
+        }
+
+        const bool inside = tile.startX >= 0 && tile.startX < tile.endX &&
+                            tile.endX <= static_cast<int>(image.width()) &&
+                            tile.startY >= 0 && tile.startY < tile.endY &&
+                            tile.endY <= static_cast<int>(image.height());
+        if (!inside)
+        {
+            std::cerr << "Coordinator asked for pixels outside the image" << std::endl;
+            return false;
+        }
+
+        render(tile);
+        pixels.clear();
+        for (int x = tile.startX; x < tile.endX; x++)
+        {
+            for (int y = tile.startY; y < tile.endY; y++)
+            {
+                for (uint i = 0; i < 3; i++)
+                {
+                    pixels.push_back(encodeFloat(static_cast<float>(image(x, y, i))));
+                }
+            }
+        }
+        if (!sendTile(m_connection, tile) ||
+            !sendAll(m_connection, pixels.data(), pixels.size() * sizeof(uint32_t)))
+        {
+            return false;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+TileClient::TileClient(const int connection, std::string address)
+    : m_connection(connection),
+      m_address(std::move(address))
+{}
+
+//---------------------------------------------------------------------------------------
+TileClient::~TileClient()
+{
+    close(m_connection);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * connect connects to a worker, and checks that it renders an image of the same size.
+ * @param address Address the worker listens on
+ * @param width Width of the image of the coordinator
+ * @param height Height of the image of the coordinator
+ * @return Connection to the worker, or nullptr if it could not connect
+ */
+std::unique_ptr<TileClient> TileClient::connect(
+    const std::string& address,
+    const uint32_t width,
+    const uint32_t height
+)
+{
+    const int fd = openSocket(address, false);
+    if (fd < 0)
+    {
+        std::cerr << "Could not connect to worker " << address << std::endl;
+        return nullptr;
+    }
+
+    // A worker that stops answering loses its rectangles to the others
+    watchConnection(fd, true);
+
+    auto client = std::make_unique<TileClient>(fd, address);
+    uint32_t hello[3] = {};
+    const bool answered = receiveAll(fd, hello, sizeof(hello));
+    for (uint32_t& word: hello)
+    {
+        word = ntohl(word);
+    }
+    if (!answered || hello[0] != HELLO_MAGIC)
+    {
+        std::cerr << "Worker " << address << " did not answer" << std::endl;
+        return nullptr;
+    }
+    if (hello[1] != width || hello[2] != height)
+    {
+        std::cerr << "Worker " << address << " renders a " << hello[1] << "x" << hello[2]
+                  << " image instead of " << width << "x" << height << std::endl;
+        return nullptr;
+    }
+    return client;
+}
+
+//---------------------------------------------------------------------------------------
+// Ask the worker for a rectangle, returns false if the connection broke
+bool TileClient::request(const TileRect& tile)
+{
+    return sendTile(m_connection, tile);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * receive waits for the reply to the oldest request, and writes its pixels to the image.
+ * @param tile Oldest request
+ * @param image Image the pixels are written to
+ * @return False if the connection broke or the reply was not for the request
+ */
+bool TileClient::receive(const TileRect& tile, Image& image)
+{
+    TileRect reply = {};
+    if (!receiveTile(m_connection, reply) || std::memcmp(&reply, &tile, sizeof(tile)) != 0)
+    {
+        return false;
+    }
+
+    m_pixels.resize(tileFloats(tile));
+    if (!receiveAll(m_connection, m_pixels.data(), m_pixels.size() * sizeof(uint32_t)))
+    {
+        return false;
+    }
+
+    size_t i = 0;
+    for (int x = tile.startX; x < tile.endX; x++)
+    {
+        for (int y = tile.startY; y < tile.endY; y++)
+        {
+            image(x, y, 0) = (double) decodeFloat(m_pixels[i++]);
+            image(x, y, 1) = (double) decodeFloat(m_pixels[i++]);
+            image(x, y, 2) = (double) decodeFloat(m_pixels[i++]);
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+const std::string& TileClient::address() const
+{
+    return m_address;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * renderRemotely renders rectangles of a frame on workers, each taking the next one from
+ * a shared queue as it finishes one. The rectangles of a worker that disconnects, or does
+ * not answer within REPLY_TIMEOUT_SECONDS, go back to the queue for the others, and the
+ * worker is dropped.
+ * @param workers Connections to the workers, less the ones lost
+ * @param tiles Rectangles to render
+ * @param image Image the pixels are written to
+ * @return Rectangles no worker rendered, if workers were lost
+ */
+std::vector<TileRect> renderRemotely(
+    std::vector<std::unique_ptr<TileClient>>& workers,
+    const std::vector<TileRect>& tiles,
+    Image& image
+)
+{
+    std::mutex mutex;
+    std::deque<TileRect> queue(tiles.begin(), tiles.end());
+
+    std::vector<char> lost(workers.size(), false);
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        threads.emplace_back([&, w]() {
+            TileClient* client = workers[w].get();
+            std::deque<TileRect> inFlight;
+            bool failed = false;
+            while (!failed)
+            {
+                while (inFlight.size() < REQUESTS_IN_FLIGHT && !failed)
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    if (queue.empty())
+                    {
+                        break;
+                    }
+                    inFlight.push_back(queue.front());
+                    queue.pop_front();
+                    lock.unlock();
+
+                    failed = !client->request(inFlight.back());
+                }
+                if (inFlight.empty())
+                {
+                    break;
+                }
+                failed = failed || !client->receive(inFlight.front(), image);
+                if (!failed)
+                {
+                    inFlight.pop_front();
+                }
+            }
+
+            if (failed)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::cerr << "Lost worker " << client->address() << std::endl;
+                queue.insert(queue.end(), inFlight.begin(), inFlight.end());
+                lost[w] = true;
+            }
+        });
+    }
+    for (std::thread& thread: threads)
+    {
+        thread.join();
+    }
+
+    size_t kept = 0;
+    for (size_t w = 0; w < workers.size(); w++)
+    {
+        if (!lost[w])
+        {
+            workers[kept++] = std::move(workers[w]);
+        }
+    }
+    workers.resize(kept);
+    return {queue.begin(), queue.end()};
+}
@@ -0,0 +1,90 @@
+/*
+ * Name: TileNetwork
+ * Description: Renders the tiles of a frame on other processes, on this machine or
+ * reachable over the network. Workers load the scene once and serve rectangles of pixels
+ * to a coordinator, which hands out the rectangles and writes the pixels they send back
+ * into its image. Addresses are "host:port" for TCP, or "unix:path" for Unix sockets.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/Image.hpp"
+
+// Width and height in pixels of the rectangles the coordinator hands out, which workers
+// split into tiles for their own threads
+const int REMOTE_TILE_SIZE = 64;
+
+/**
+ * TileRect is a request for the pixels [startX, endX) x [startY, endY) of a frame. The
+ * same rectangle comes back at the head of the reply, followed by the red, green and
+ * blue floats of the pixels, column by column. Fields and floats are sent as big-endian
+ * 32-bit words, so hosts of any byte order work together as long as their floats are
+ * IEEE 754.
+ */
+struct TileRect {
+    int32_t frame;
+    int32_t startX;
+    int32_t endX;
+    int32_t startY;
+    int32_t endY;
+};
+
+/**
+ * TileServer is the worker side. It waits for a coordinator, then renders the rectangles
+ * it asks for, one frame at a time in the order of the frames.
+ */
+class TileServer {
+public:
+    explicit TileServer(const std::string& address);
+    ~TileServer();
+
+    bool accept(uint32_t width, uint32_t height);
+    bool serveFrame(
+        int frame,
+        const std::function<void(const TileRect&)>& render,
+        const Image& image
+    );
+
+private:
+    std::string m_address;
+    int m_listener = -1;
+    int m_connection = -1;
+    bool m_hasPending = false; // Whether m_pending is a request for a later frame
+    TileRect m_pending = {};
+};
+
+/**
+ * TileClient is the coordinator side of the connection to one worker.
+ */
+class TileClient {
+public:
+    TileClient(int connection, std::string address);
+    ~TileClient();
+
+    static std::unique_ptr<TileClient> connect(
+        const std::string& address,
+        uint32_t width,
+        uint32_t height
+    );
+
+    bool request(const TileRect& tile);
+    bool receive(const TileRect& tile, Image& image);
+    [[nodiscard]] const std::string& address() const;
+
+private:
+    int m_connection;
+    std::string m_address;
+    std::vector<uint32_t> m_pixels; // Words of the pixels of the last reply
+};
+
+std::vector<TileRect> renderRemotely(
+    std::vector<std::unique_ptr<TileClient>>& workers,
+    const std::vector<TileRect>& tiles,
+    Image& image
+);
@@ -34,21 +34,50 @@ void GeometryNode::setDisplacementMap(Animation* displacementMap)
 }
 
 //---------------------------------------------------------------------------------------
-// Checks if this geometry's m_primitive intersects with the ray
-// Returns an Intersection (in model coords) if an intersection exists
-Intersection GeometryNode::intersect(const Ray& ray) const
+// Makes a copy of this node tracing the copy of m_primitive for time t, if it has one
+std::unique_ptr<SceneNode> GeometryNode::atTime(
+    const float t,
+    FramePrimitives& primitives
+) const
 {
-    Intersection intersection;
-
-    // If this node intersected with the ray, update intersection values
-    if (m_primitive->intersect(ray, intersection))
+    Primitive* primitive = primitiveAtTime(m_primitive, t, primitives);
+    if (primitive == nullptr)
     {
-        // Found intersection, update material, normal, uv coordinates
-        intersection.m_material = static_cast<PhongMaterial*>(m_material);
-        m_primitive->normal(intersection.m_point, ray.time(), intersection.m_normal);
-        m_primitive->getUV(intersection.m_point, ray.time(), intersection.m_uv);
-        intersection.m_foundIntersection = true;
+        return nullptr;
     }
+    return std::make_unique<GeometryNode>(m_name, primitive, m_material);
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if this geometry's m_primitive is hit before the parametric distance tMax
+bool GeometryNode::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    return m_primitive->closestHit(ray, tMax, hit);
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the point, normal, uv coordinates (in model coords) and material of a hit
+void GeometryNode::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+    m_primitive->finalizeHit(ray, hit, intersection);
+    intersection.m_material = static_cast<PhongMaterial*>(m_material);
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if m_primitive blocks the ray before the parametric distance tMax, without
+// computing the material, normal or uv coordinates of the hit
+bool GeometryNode::occluded(const Ray& ray, const float tMax) const
+{
+    return m_primitive->occluded(ray, tMax);
+}
 
-    return intersection;
+//---------------------------------------------------------------------------------------
+// Computes the bounding box of m_primitive in model coords at time t
+AABB GeometryNode::bounds(const float t) const
+{
+    return m_primitive->bounds(t);
 }
@@ -16,7 +16,11 @@ public:
     void setMaterial(Material* material);
     void setDisplacementMap(Animation* displacementMap);
 
-    virtual Intersection intersect(const Ray& ray) const;
+    virtual std::unique_ptr<SceneNode> atTime(float t, FramePrimitives& primitives) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
+    virtual AABB bounds(float t) const;
 
     Material* m_material;
     Primitive* m_primitive;
@@ -0,0 +1,176 @@
+#include "InstanceNode.hpp"
+
+#include <limits>
+
+#include "core/Threads.hpp"
+
+//---------------------------------------------------------------------------------------
+/**
+ * Custom constructor for InstanceNode, instances are added with addInstance.
+ * @param name Name of the node
+ * @param primitive Primitive placed by every instance, may be shared with other nodes
+ * @param materials Materials instances can choose from
+ */
+InstanceNode::InstanceNode(
+    const std::string& name,
+    Primitive* primitive,
+    const std::vector<Material*>& materials
+)
+    : SceneNode(name),
+      m_primitive(primitive),
+      m_materials(materials)
+{
+    m_nodeType = NodeType::InstanceNode;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * addInstance places a copy of the primitive. The hierarchy over the instances is built
+ * by buildHierarchy once they are all added.
+ * @param trans Affine transformation from primitive coordinates to node model coordinates
+ * @param material Index into the materials of the node
+ */
+void InstanceNode::addInstance(const glm::mat4& trans, const uint32_t material)
+{
+    m_instances.push_back({glm::mat4x3(glm::inverse(trans)), material});
+    m_bvh = WideBVH();
+}
+
+//---------------------------------------------------------------------------------------
+// Builds the hierarchy over the instances around the primitive at rest, before any of
+// its animations. Frames where the primitive is elsewhere trace a refit copy of the node
+void InstanceNode::buildHierarchy()
+{
+    m_primitiveBounds = m_primitive->bounds(std::numeric_limits<float>::lowest());
+    if (!m_instances.empty() && !m_primitiveBounds.isEmpty())
+    {
+        m_bvh.build(instanceBounds(), workerThreadCount());
+    }
+}
+
+//---------------------------------------------------------------------------------------
+// Makes a copy of this node for time t if the primitive has a copy for the frame or has
+// moved, with the hierarchy over the instances refit to the bounds of the primitive then
+std::unique_ptr<SceneNode> InstanceNode::atTime(
+    const float t,
+    FramePrimitives& primitives
+) const
+{
+    Primitive* framePrimitive = primitiveAtTime(m_primitive, t, primitives);
+    Primitive* primitive = framePrimitive != nullptr ? framePrimitive : m_primitive;
+    const AABB primitiveBounds = primitive->bounds(t);
+    const bool moved = primitiveBounds.min != m_primitiveBounds.min ||
+                       primitiveBounds.max != m_primitiveBounds.max;
+    if (framePrimitive == nullptr && !moved)
+    {
+        return nullptr;
+    }
+
+    auto node = std::make_unique<InstanceNode>(m_name, primitive, m_materials);
+    node->m_instances = m_instances;
+    node->m_primitiveBounds = primitiveBounds;
+    if (m_instances.empty() || primitiveBounds.isEmpty())
+    {
+        return node;
+    }
+    if (m_bvh.isEmpty())
+    {
+        node->m_bvh.build(node->instanceBounds(), workerThreadCount());
+    }
+    else
+    {
+        node->m_bvh = m_bvh;
+        if (moved)
+        {
+            node->m_bvh.refit(node->instanceBounds());
+        }
+    }
+    return node;
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the bounding box of every instance in model coords from m_primitiveBounds
+std::vector<AABB> InstanceNode::instanceBounds() const
+{
+    std::vector<AABB> result;
+    result.reserve(m_instances.size());
+    for (const PrimitiveInstance& instance: m_instances)
+    {
+        const glm::mat4 trans = glm::inverse(glm::mat4(instance.invTrans));
+        result.push_back(m_primitiveBounds.transformed(trans));
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if any instance is hit before the parametric distance tMax, recording the
+// closest one. Affine transformations keep the parametric distance, so hits on
+// differently scaled instances are compared with it directly
+bool InstanceNode::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    return m_bvh.traverse(
+        ray.transformedOrigin(), ray.transformedDirection(), tMax,
+        [&](const uint32_t index, float& tMaxInstance) {
+            Ray instanceRay = ray;
+            instanceRay.transformModel(m_instances[index].invTrans);
+            if (!m_primitive->closestHit(instanceRay, tMaxInstance, hit))
+            {
+                return false;
+            }
+            hit.copy = index;
+            return true;
+        });
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the point, normal, uv coordinates (in model coords) and material of a hit on
+// the instance recorded in hit.copy
+void InstanceNode::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+    const PrimitiveInstance& instance = m_instances[hit.copy];
+    Ray instanceRay = ray;
+    instanceRay.transformModel(instance.invTrans);
+
+    Intersection temp;
+    m_primitive->finalizeHit(instanceRay, hit, temp);
+    intersection.m_point = ray.transformedOrigin() + hit.t * ray.transformedDirection();
+    intersection.m_normal = glm::normalize(
+        glm::transpose(glm::mat3(instance.invTrans)) * temp.m_normal);
+    intersection.m_uv = temp.m_uv;
+    intersection.m_material = static_cast<PhongMaterial*>(m_materials[instance.material]);
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if any instance blocks the ray before the parametric distance tMax, stopping at
+// the first one that does. Affine transformations keep the parametric distance
+bool InstanceNode::occluded(const Ray& ray, float tMax) const
+{
+    return m_bvh.traverse(
+        ray.transformedOrigin(), ray.transformedDirection(), tMax,
+        [&](const uint32_t index, float& tMaxInstance) {
+            Ray instanceRay = ray;
+            instanceRay.transformModel(m_instances[index].invTrans);
+            if (!m_primitive->occluded(instanceRay, tMaxInstance))
+            {
+                return false;
+            }
+            tMaxInstance = -1.0f; // Any hit will do, end the walk
+            return true;
+        });
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the bounding box of all instances in model coords, which is only valid at the
+// times of the frames this node was made for by atTime
+AABB InstanceNode::bounds(float) const
+{
+    if (m_bvh.isEmpty())
+    {
+        return {};
+    }
+    return m_bvh.bounds();
+}
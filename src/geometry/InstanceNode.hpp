@@ -0,0 +1,59 @@
+/**
+ * Name: InstanceNode
+ * Description: Contains the definition of the InstanceNode class, which places many
+ * copies of a single primitive (usually a mesh) in the scene. Each copy only stores an
+ * affine transformation and a material index, and the copies are traced through a
+ * hierarchy over their bounds that shares the primitive's own hierarchy.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "acceleration/WideBVH.hpp"
+#include "geometry/Primitive.hpp"
+#include "geometry/SceneNode.hpp"
+#include "materials/Material.hpp"
+
+/**
+ * PrimitiveInstance is a single copy of the primitive of an InstanceNode.
+ */
+struct PrimitiveInstance {
+    glm::mat4x3 invTrans; // Node model coordinates to primitive coordinates
+    uint32_t material;    // Index into the materials of the node
+};
+
+/**
+ * InstanceNode class holds a set of instances of a primitive. The primitive may be shared
+ * with other nodes, so a mesh is loaded and its hierarchy is built only once however
+ * often it is placed.
+ */
+class InstanceNode : public SceneNode {
+public:
+    InstanceNode(
+        const std::string& name,
+        Primitive* primitive,
+        const std::vector<Material*>& materials
+    );
+
+    void addInstance(const glm::mat4& trans, uint32_t material);
+    void buildHierarchy();
+
+    std::unique_ptr<SceneNode> atTime(float t, FramePrimitives& primitives) const override;
+    bool closestHit(const Ray& ray, float& tMax, Hit& hit) const override;
+    void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const override;
+    [[nodiscard]] bool occluded(const Ray& ray, float tMax) const override;
+    [[nodiscard]] AABB bounds(float t) const override;
+
+private:
+    std::vector<AABB> instanceBounds() const;
+
+    Primitive* m_primitive;
+    std::vector<Material*> m_materials;
+    std::vector<PrimitiveInstance> m_instances;
+    WideBVH m_bvh; // Hierarchy over the bounds of m_instances
+    AABB m_primitiveBounds; // Bounds of m_primitive that m_bvh was last fit to
+};
@@ -22,12 +22,13 @@ void getUVSphere(
 }
 
 //---------------------------------------------------------------------------------------
-// Computes general ray-sphere intersection
-bool sphereIntersect(
+// Computes the parametric distance t along the ray (in model coords) of the closest
+// intersection with a sphere in front of the ray, without computing the point itself
+static bool sphereDistance(
     const Ray& ray,
     const glm::vec3& pos,
     const float radius,
-    Intersection& intersection
+    float& t
 )
 {
     glm::vec3 ca = ray.transformedOrigin() - pos;
@@ -50,9 +51,7 @@ bool sphereIntersect(
             return false;
         }
 
-        // Return the intersection point
-        float t = static_cast<float>(roots[0]);
-        intersection.m_point = ray.transformedOrigin() + t * ray.transformedDirection();
+        t = static_cast<float>(roots[0]);
     }
     else // Case 3: Two intersections
     {
@@ -62,11 +61,30 @@ bool sphereIntersect(
         }
 
         // Get the smaller positive t
-        float t = (std::min(roots[0], roots[1]) > 0) ? std::min(roots[0], roots[1]) : std::max(roots[0], roots[1]);
+        t = static_cast<float>((std::min(roots[0], roots[1]) > 0)
+                                   ? std::min(roots[0], roots[1])
+                                   : std::max(roots[0], roots[1]));
+    }
+    return true;
+}
 
-        // Return the intersection point        
-        intersection.m_point = ray.transformedOrigin() + t * ray.transformedDirection();
+//---------------------------------------------------------------------------------------
+// Computes general ray-sphere intersection
+bool sphereIntersect(
+    const Ray& ray,
+    const glm::vec3& pos,
+    const float radius,
+    Intersection& intersection
+)
+{
+    float t;
+    if (!sphereDistance(ray, pos, radius, t))
+    {
+        return false;
     }
+
+    // Return the intersection point
+    intersection.m_point = ray.transformedOrigin() + t * ray.transformedDirection();
     return true;
 }
 
@@ -111,96 +129,111 @@ void getUVBox(
 }
 
 //---------------------------------------------------------------------------------------
-// Computes general ray-box intersection
-bool boxIntersect(
+// Computes the parametric distance t along the ray (in model coords) of the face of a box
+// it hits first in front of it using the slab method, and which face that is as
+// axis * 2, plus 1 for the face at the far corner of the box
+// We assume that boxes are aligned to the model axes
+static bool boxDistance(
     const Ray& ray,
     const glm::vec3& pos,
     const glm::vec3& size,
-    Intersection& intersection
+    float& t,
+    uint32_t& face
 )
 {
-    // First, set the points and normals of the planes to iterate through
-    // We assume that cubes are world axis aligned
-    glm::vec3 planePoints[6];
-    glm::vec3 normals[6];
-
-    // Planes (first three share a point with pos, last three with opposite corner)
-    for (int i = 0; i < 3; i++)
+    const glm::vec3 origin = ray.transformedOrigin();
+    const glm::vec3 direction = ray.transformedDirection();
+    const glm::vec3 invDir = 1.0f / direction;
+
+    // Distances to the pair of planes bounding the box along each axis, with the box
+    // grown by the epsilon so rays grazing an edge still hit it
+    const glm::vec3 t0 = (pos - glm::vec3(E) - origin) * invDir;
+    const glm::vec3 t1 = (pos + size + glm::vec3(E) - origin) * invDir;
+    const glm::vec3 tSmall = glm::min(t0, t1);
+    const glm::vec3 tBig = glm::max(t0, t1);
+
+    // The ray enters through the plane it reaches last, and exits through the first
+    int entryAxis = 0;
+    int exitAxis = 0;
+    for (int i = 1; i < 3; i++)
     {
-        planePoints[i] = pos;
+        if (tSmall[i] > tSmall[entryAxis])
+        {
+            entryAxis = i;
+        }
+        if (tBig[i] < tBig[exitAxis])
+        {
+            exitAxis = i;
+        }
     }
-    for (int i = 3; i < 6; i++)
+
+    if (tSmall[entryAxis] > tBig[exitAxis])
     {
-        planePoints[i] = pos + size;
+        return false;
     }
 
-    // Normals point to the inside of box
-    // Since this is the constructor, no transformations have been applied.
-    // We can assume it is aligned to world axis
-    normals[0] = glm::vec3(1.0f, 0.0f, 0.0f);
-    normals[1] = glm::vec3(0.0f, 1.0f, 0.0f);
-    normals[2] = glm::vec3(0.0f, 0.0f, 1.0f);
-    normals[3] = glm::vec3(-1.0f, 0.0f, 0.0f);
-    normals[4] = glm::vec3(0.0f, -1.0f, 0.0f);
-    normals[5] = glm::vec3(0.0f, 0.0f, -1.0f);
-
-    // Iterate through each plane
-    bool intersectionFound = false;
-    glm::vec3 intersectionPoint;
-    int intersectionPlane;
-    glm::vec2 intersectionUV;
-    for (int i = 0; i < 6; i++)
+    // Intersect the actual face, using the entry face if it is in front of the ray and
+    // otherwise the exit face (we are inside the box)
+    bool minFace = direction[entryAxis] > 0;
+    int axis = entryAxis;
+    t = ((minFace ? pos : pos + size)[axis] - origin[axis]) * invDir[axis];
+    if (t <= 0)
     {
-        float wecB = glm::dot(ray.transformedDirection(), normals[i]);
-
-        if (abs(wecB) < 1e-8) // Avoid division by 0
+        minFace = direction[exitAxis] < 0;
+        axis = exitAxis;
+        t = ((minFace ? pos : pos + size)[axis] - origin[axis]) * invDir[axis];
+        if (t <= 0)
         {
-            continue;
+            return false;
         }
+    }
 
-        // Get intersection point
-        float wecA = glm::dot((planePoints[i] - ray.transformedOrigin()), normals[i]);
-        float t = wecA / wecB;
-        glm::vec3 p = ray.transformedOrigin() + t * ray.transformedDirection();
-
-        // Verify that t >= 0 (point is in front of ray) and within boundary of box
-        if (
-            (t <= 0) ||
-            (p.x > (pos.x + size.x + E) || p.x < (pos.x - E)) ||
-            (p.y > (pos.y + size.y + E) || p.y < (pos.y - E)) ||
-            (p.z > (pos.z + size.z + E) || p.z < (pos.z - E))
-        )
-        {
-            continue;
-        }
+    face = static_cast<uint32_t>(axis * 2 + (minFace ? 0 : 1));
+    return true;
+}
 
-        // If an intersection has already been found check which point is closer
-        // Also check which face is looking towards the eye based on normals
-        if (!intersectionFound ||
-            (intersectionFound &&
-             ((glm::length(p - ray.transformedOrigin()) <
-               glm::length(intersectionPoint - ray.transformedOrigin())) &&
-              (dot(ray.transformedDirection(), normals[i]) >
-               dot(ray.transformedDirection(), normals[intersectionPlane]))))
-        )
-        {
-            intersectionPlane = i;
-            intersectionPoint = p;
-            getUVBox(p, planePoints[intersectionPlane], size, intersectionUV);
-        }
-        intersectionFound = true;
-    }
+//---------------------------------------------------------------------------------------
+// Computes the point, normal and uv coordinates where a ray hits the face of a box found
+// by boxDistance, at the parametric distance t
+static void boxSurface(
+    const Ray& ray,
+    const glm::vec3& pos,
+    const glm::vec3& size,
+    const float t,
+    const uint32_t face,
+    Intersection& intersection
+)
+{
+    const int axis = static_cast<int>(face / 2);
+    const bool minFace = face % 2 == 0;
 
-    // Output result
-    if (intersectionFound)
-    {
-        intersection.m_point = intersectionPoint;
-        intersection.m_uv = intersectionUV;
+    // Normals face out of the box
+    glm::vec3 normal(0.0f);
+    normal[axis] = minFace ? -1.0f : 1.0f;
+
+    intersection.m_point = ray.transformedOrigin() + t * ray.transformedDirection();
+    intersection.m_normal = normal;
+    getUVBox(intersection.m_point, minFace ? pos : pos + size, size, intersection.m_uv);
+}
 
-        // Flip normal as the stored normal faces inwards
-        intersection.m_normal = glm::normalize(-1.0f * normals[intersectionPlane]);
+//---------------------------------------------------------------------------------------
+// Computes general ray-box intersection
+bool boxIntersect(
+    const Ray& ray,
+    const glm::vec3& pos,
+    const glm::vec3& size,
+    Intersection& intersection
+)
+{
+    float t;
+    uint32_t face;
+    if (!boxDistance(ray, pos, size, t, face))
+    {
+        return false;
     }
-    return intersectionFound;
+
+    boxSurface(ray, pos, size, t, face, intersection);
+    return true;
 }
 
 //---------------------------------------------------------------------------------------
@@ -215,6 +248,62 @@ bool Primitive::intersect(const Ray& ray, Intersection& intersection) const
     return false;
 }
 
+//---------------------------------------------------------------------------------------
+// Parametric distance along the ray (in model coords) of a point it passes through
+static float parametricDistance(const Ray& ray, const glm::vec3& point)
+{
+    const glm::vec3 direction = ray.transformedDirection();
+    return glm::dot(point - ray.transformedOrigin(), direction) /
+           glm::dot(direction, direction);
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if this geometry is hit before the parametric distance tMax, and if so records
+// the hit and shrinks tMax to it. The surface at the hit is found later by finalizeHit
+// By default the closest intersection is found and its distance along the ray compared
+bool Primitive::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    Intersection intersection;
+    if (!intersect(ray, intersection))
+    {
+        return false;
+    }
+
+    const float t = parametricDistance(ray, intersection.m_point);
+    if (t >= tMax)
+    {
+        return false;
+    }
+
+    tMax = t;
+    hit.t = t;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the point, normal and uv coordinates (in model coords) of a hit recorded by
+// closestHit, by default from the point alone
+void Primitive::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+    intersection.m_point = ray.transformedOrigin() + hit.t * ray.transformedDirection();
+    normal(intersection.m_point, ray.time(), intersection.m_normal);
+    getUV(intersection.m_point, ray.time(), intersection.m_uv);
+}
+
+//---------------------------------------------------------------------------------------
+// Checks if this geometry blocks the ray before the parametric distance tMax
+// By default the closest intersection is found and its distance along the ray compared
+bool Primitive::occluded(const Ray& ray, const float tMax) const
+{
+    Intersection intersection;
+    return intersect(ray, intersection) &&
+           parametricDistance(ray, intersection.m_point) < tMax;
+}
+
 //---------------------------------------------------------------------------------------
 // Computes the normal of a point on the primitive
 // For a default primative, don't do anything 
@@ -227,6 +316,46 @@ void Primitive::normal(const glm::vec3& p, const float t, glm::vec3& n) const
 void Primitive::getUV(const glm::vec3& p, const float t, glm::vec2& uv) const
 {}
 
+//---------------------------------------------------------------------------------------
+// Computes the bounding box of the primitive at time t
+// For a default primative, the box is empty as nothing can be hit
+AABB Primitive::bounds(float) const
+{
+    return {};
+}
+
+//---------------------------------------------------------------------------------------
+// Makes a copy of the primitive as it is at time t, if it changes between frames in more
+// than the translation rays are traced against
+// For a default primative, nothing changes and there is no copy
+std::unique_ptr<Primitive> Primitive::atTime(float) const
+{
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * primitiveAtTime gets the copy of a primitive for the frame at time t, making it the
+ * first time it is asked for.
+ * @param primitive Primitive of the scene
+ * @param t Frame time the copies are made for
+ * @param primitives Copies made for this frame so far
+ * @return Copy of the primitive, or nullptr if it is the same at every time
+ */
+Primitive* primitiveAtTime(
+    const Primitive* primitive,
+    const float t,
+    FramePrimitives& primitives
+)
+{
+    auto copy = primitives.find(primitive);
+    if (copy == primitives.end())
+    {
+        copy = primitives.emplace(primitive, primitive->atTime(t)).first;
+    }
+    return copy->second.get();
+}
+
 //---------------------------------------------------------------------------------------
 // Computes the position of a point of the primitive based on the animation
 void Primitive::getFramePosition(
@@ -266,6 +395,37 @@ bool Sphere::intersect(const Ray& ray, Intersection& intersection) const
     return sphereIntersect(ray, updatedPos, 1.0f, intersection);
 }
 
+//---------------------------------------------------------------------------------------
+// Only the distance to the sphere is needed to compare hits, the surface is found for the
+// closest hit by finalizeHit
+bool Sphere::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+
+    float t;
+    if (!sphereDistance(ray, updatedPos, 1.0f, t) || t >= tMax)
+    {
+        return false;
+    }
+
+    tMax = t;
+    hit.t = t;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+bool Sphere::occluded(const Ray& ray, const float tMax) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+
+    float t;
+    return sphereDistance(ray, updatedPos, 1.0f, t) && t < tMax;
+}
+
 //---------------------------------------------------------------------------------------
 void Sphere::normal(const glm::vec3& p, const float t, glm::vec3& n) const
 {
@@ -286,6 +446,16 @@ void Sphere::getUV(const glm::vec3& p, const float t, glm::vec2& uv) const
     getUVSphere(p, updatedPos, uv);
 }
 
+//---------------------------------------------------------------------------------------
+AABB Sphere::bounds(const float t) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(t, glm::vec3(0.0f), updatedPos);
+
+    return {updatedPos - glm::vec3(1.0f), updatedPos + glm::vec3(1.0f)};
+}
+
 //---------------------------------------------------------------------------------------
 Cube::~Cube()
 {}
@@ -300,6 +470,62 @@ bool Cube::intersect(const Ray& ray, Intersection& intersection) const
     return boxIntersect(ray, updatedPos, glm::vec3(1.0f), intersection);
 }
 
+//---------------------------------------------------------------------------------------
+// Only the distance to the box is needed to compare hits, the face hit is kept in
+// hit.primitive for finalizeHit to find the surface of the closest hit
+bool Cube::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+
+    float t;
+    uint32_t face;
+    if (!boxDistance(ray, updatedPos, glm::vec3(1.0f), t, face) || t >= tMax)
+    {
+        return false;
+    }
+
+    tMax = t;
+    hit.t = t;
+    hit.primitive = face;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// The normal and uv coordinates depend on the face that was hit, recorded by closestHit
+void Cube::finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+
+    boxSurface(ray, updatedPos, glm::vec3(1.0f), hit.t, hit.primitive, intersection);
+}
+
+//---------------------------------------------------------------------------------------
+bool Cube::occluded(const Ray& ray, const float tMax) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+
+    float t;
+    uint32_t face;
+    return boxDistance(ray, updatedPos, glm::vec3(1.0f), t, face) && t < tMax;
+}
+
+//---------------------------------------------------------------------------------------
+AABB Cube::bounds(const float t) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(t, glm::vec3(0.0f), updatedPos);
+
+    // Pad by the epsilon that boxIntersect tolerates
+    return {updatedPos - glm::vec3(E), updatedPos + glm::vec3(1.0f + E)};
+}
+
 
 //---------------------------------------------------------------------------------------
 NonhierSphere::~NonhierSphere()
@@ -315,6 +541,37 @@ bool NonhierSphere::intersect(const Ray& ray, Intersection& intersection) const
     return sphereIntersect(ray, updatedPos, m_radius, intersection);
 }
 
+//---------------------------------------------------------------------------------------
+// Only the distance to the sphere is needed to compare hits, the surface is found for the
+// closest hit by finalizeHit
+bool NonhierSphere::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), m_pos, updatedPos);
+
+    float t;
+    if (!sphereDistance(ray, updatedPos, m_radius, t) || t >= tMax)
+    {
+        return false;
+    }
+
+    tMax = t;
+    hit.t = t;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+bool NonhierSphere::occluded(const Ray& ray, const float tMax) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), m_pos, updatedPos);
+
+    float t;
+    return sphereDistance(ray, updatedPos, m_radius, t) && t < tMax;
+}
+
 //---------------------------------------------------------------------------------------
 void NonhierSphere::normal(const glm::vec3& p, const float t, glm::vec3& n) const
 {
@@ -335,6 +592,17 @@ void NonhierSphere::getUV(const glm::vec3& p, const float t, glm::vec2& uv) cons
     getUVSphere(p, updatedPos, uv);
 }
 
+//---------------------------------------------------------------------------------------
+AABB NonhierSphere::bounds(const float t) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(t, m_pos, updatedPos);
+
+    const auto radius = static_cast<float>(m_radius);
+    return {updatedPos - glm::vec3(radius), updatedPos + glm::vec3(radius)};
+}
+
 //---------------------------------------------------------------------------------------
 NonhierBox::~NonhierBox()
 {}
@@ -348,3 +616,59 @@ bool NonhierBox::intersect(const Ray& ray, Intersection& intersection) const
 
     return boxIntersect(ray, updatedPos, glm::vec3(m_size), intersection);
 }
+
+//---------------------------------------------------------------------------------------
+// Only the distance to the box is needed to compare hits, the face hit is kept in
+// hit.primitive for finalizeHit to find the surface of the closest hit
+bool NonhierBox::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), m_pos, updatedPos);
+
+    float t;
+    uint32_t face;
+    if (!boxDistance(ray, updatedPos, glm::vec3(m_size), t, face) || t >= tMax)
+    {
+        return false;
+    }
+
+    tMax = t;
+    hit.t = t;
+    hit.primitive = face;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+// The normal and uv coordinates depend on the face that was hit, recorded by closestHit
+void NonhierBox::finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), m_pos, updatedPos);
+
+    boxSurface(ray, updatedPos, glm::vec3(m_size), hit.t, hit.primitive, intersection);
+}
+
+//---------------------------------------------------------------------------------------
+bool NonhierBox::occluded(const Ray& ray, const float tMax) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), m_pos, updatedPos);
+
+    float t;
+    uint32_t face;
+    return boxDistance(ray, updatedPos, glm::vec3(m_size), t, face) && t < tMax;
+}
+
+//---------------------------------------------------------------------------------------
+AABB NonhierBox::bounds(const float t) const
+{
+    // Get position of point at this frame after animation
+    glm::vec3 updatedPos;
+    getFramePosition(t, m_pos, updatedPos);
+
+    // Pad by the epsilon that boxIntersect tolerates
+    return {updatedPos - glm::vec3(E), updatedPos + m_size + glm::vec3(E)};
+}
@@ -1,20 +1,34 @@
 #pragma once
 
+#include <map>
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "acceleration/AABB.hpp"
 #include "animation/Animation.hpp"
 #include "core/Ray.hpp"
 
+class Primitive;
+
+// Copies of the primitives that change between frames, made for one frame. Nodes sharing
+// a primitive share its copy
+using FramePrimitives = std::map<const Primitive*, std::unique_ptr<Primitive>>;
+
 //---------------------------------------------------------------------------------------
 class Primitive {
 public:
     virtual ~Primitive();
 
     virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
     virtual void normal(const glm::vec3& p, const float t, glm::vec3& n) const;
     virtual void getUV(const glm::vec3& p, const float t, glm::vec2& uv) const;
+    virtual AABB bounds(float t) const;
+    [[nodiscard]] virtual std::unique_ptr<Primitive> atTime(float t) const;
 
     void getFramePosition(
         float t,
@@ -29,14 +43,23 @@ public:
     Animation m_displacementMap;
 };
 
+Primitive* primitiveAtTime(
+    const Primitive* primitive,
+    float t,
+    FramePrimitives& primitives
+);
+
 //---------------------------------------------------------------------------------------
 class Sphere : public Primitive {
 public:
     virtual ~Sphere();
 
     virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
     virtual void normal(const glm::vec3& p, const float t, glm::vec3& n) const;
     virtual void getUV(const glm::vec3& p, const float t, glm::vec2& uv) const;
+    virtual AABB bounds(float t) const;
 };
 
 //---------------------------------------------------------------------------------------
@@ -45,6 +68,10 @@ public:
     virtual ~Cube();
 
     virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
+    virtual AABB bounds(float t) const;
 };
 
 //---------------------------------------------------------------------------------------
@@ -56,8 +83,11 @@ public:
     virtual ~NonhierSphere();
 
     virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
     virtual void normal(const glm::vec3& p, const float t, glm::vec3& n) const;
     virtual void getUV(const glm::vec3& p, const float t, glm::vec2& uv) const;
+    virtual AABB bounds(float t) const;
 
 private:
     glm::vec3 m_pos;
@@ -74,6 +104,10 @@ public:
     virtual ~NonhierBox();
 
     virtual bool intersect(const Ray& ray, Intersection& intersection) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
+    virtual AABB bounds(float t) const;
 
     // private:
     glm::vec3 m_pos;
@@ -1,5 +1,6 @@
 #include "SceneNode.hpp"
 
+#include <algorithm>
 #include <sstream>
 using namespace std;
 
@@ -119,55 +120,47 @@ void SceneNode::setAnimation(Animation* animation)
 }
 
 //---------------------------------------------------------------------------------------
-// Animates a node for this frame by displacing it using m_animations
-void SceneNode::animateNode(const float t)
+/**
+ * transformsAt computes the transformations of this node displaced by m_animations for
+ * the frame at time t, leaving the node as it is so frames can be evaluated in any order.
+ * @param t Frame time
+ * @param animatedTrans Set to the transformation of the node at time t
+ * @param animatedInvTrans Set to the inverse of animatedTrans
+ */
+void SceneNode::transformsAt(
+    const float t,
+    glm::mat4& animatedTrans,
+    glm::mat4& animatedInvTrans
+) const
 {
-    // Store the transformation matrix before animation so we can reset it
-    m_originalTrans = trans;
+    animatedTrans = trans;
+    if (m_animations.empty())
+    {
+        animatedInvTrans = invtrans;
+        return;
+    }
 
     // Loop through vector of animations (assumed to be in chronological order)
     for (const Animation* animation: m_animations)
     {
-        // Translations
+        if (t < animation->m_start) // Stop if this animation is not reached yet
+        {
+            break;
+        }
+
+        // Full animation if it is completed, otherwise we are in the middle of it
+        const float elapsed = std::min(t, animation->m_end) - animation->m_start;
         if (animation->m_type == AnimationType::Translate)
         {
-            if (t < animation->m_start) // Stop if this animation is not reached yet
-            {
-                break;
-            }
-
-            if (t > animation->m_end) // Full translation if animation is completed
-            {
-                translate(animation->m_animation(animation->m_end - animation->m_start));
-            }
-            else // We are in the middle of this animation
-            {
-                translate(animation->m_animation(t - animation->m_start));
-            }
+            animatedTrans = glm::translate(animation->m_animation(elapsed)) * animatedTrans;
         }
-        else if (animation->m_type == AnimationType::Rotate) // Rotations
+        else if (animation->m_type == AnimationType::Rotate) // Rotations about y
         {
-            if (t < animation->m_start) // Stop if this animation is not reached yet
-            {
-                break;
-            }
-            else if (t > animation->m_end) // Full translation if animation is completed
-            {
-                rotate('y', animation->m_scalarAnimation(animation->m_end - animation->m_start));
-            }
-            else // We are in the middle of this animation
-            {
-                rotate('y', animation->m_scalarAnimation(t - animation->m_start));
-            }
+            const float angle = degreesToRadians(animation->m_scalarAnimation(elapsed));
+            animatedTrans = glm::rotate(angle, vec3(0, 1, 0)) * animatedTrans;
         }
     }
-}
-
-//---------------------------------------------------------------------------------------
-// Resets this node's transformation to its original position
-void SceneNode::resetAnimation()
-{
-    set_transform(m_originalTrans);
+    animatedInvTrans = glm::inverse(animatedTrans);
 }
 
 //---------------------------------------------------------------------------------------
@@ -194,6 +187,9 @@ std::ostream& operator <<(std::ostream& os, const SceneNode& node)
         case NodeType::ParticleNode:
             os << "ParticleNode";
             break;
+        case NodeType::InstanceNode:
+            os << "InstanceNode";
+            break;
         default:
             break;
     }
@@ -207,9 +203,42 @@ std::ostream& operator <<(std::ostream& os, const SceneNode& node)
 }
 
 //---------------------------------------------------------------------------------------
-// Checks if this geometry intersects with the ray
+// Checks if this geometry is hit before the parametric distance tMax, and if so records
+// the hit and shrinks tMax to it
 // For a SceneNode without geometry, no intersection is possible
-Intersection SceneNode::intersect(const Ray& ray) const
+bool SceneNode::closestHit(const Ray&, float&, Hit&) const
+{
+    return false;
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the point, normal, uv coordinates and material (in model coords) of a hit
+// recorded by closestHit
+// For a SceneNode without geometry, there is never a hit to finalize
+void SceneNode::finalizeHit(const Ray&, const Hit&, Intersection&) const
+{}
+
+//---------------------------------------------------------------------------------------
+// Checks if this geometry blocks the ray before the parametric distance tMax
+// For a SceneNode without geometry, nothing is ever blocked
+bool SceneNode::occluded(const Ray&, float) const
+{
+    return false;
+}
+
+//---------------------------------------------------------------------------------------
+// Makes a copy of this node, without children, with its geometry as it is at time t if
+// it changes between frames. Primitives are copied through primitives
+// For a SceneNode without geometry, nothing changes and there is no copy
+std::unique_ptr<SceneNode> SceneNode::atTime(float, FramePrimitives&) const
+{
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------
+// Computes the bounding box of this node's geometry in model coordinates at time t
+// For a SceneNode without geometry, the box is empty
+AABB SceneNode::bounds(float) const
 {
-    return Intersection();
+    return {};
 }
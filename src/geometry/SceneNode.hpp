@@ -2,13 +2,16 @@
 
 #include <iostream>
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "acceleration/AABB.hpp"
 #include "animation/Animation.hpp"
 #include "core/Ray.hpp"
+#include "geometry/Primitive.hpp"
 #include "materials/Material.hpp"
 
 enum class NodeType {
@@ -16,6 +19,7 @@ enum class NodeType {
     GeometryNode,
     JointNode,
     ParticleNode,
+    InstanceNode,
 };
 
 class SceneNode {
@@ -39,18 +43,20 @@ public:
     void translate(const glm::vec3& amount);
 
     void setAnimation(Animation* animation);
-    void animateNode(float t);
-    void resetAnimation();
+    void transformsAt(float t, glm::mat4& animatedTrans, glm::mat4& animatedInvTrans) const;
+    virtual std::unique_ptr<SceneNode> atTime(float t, FramePrimitives& primitives) const;
 
     friend std::ostream& operator <<(std::ostream& os, const SceneNode& node);
 
-    virtual Intersection intersect(const Ray& ray) const;
+    virtual bool closestHit(const Ray& ray, float& tMax, Hit& hit) const;
+    virtual void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const;
+    virtual bool occluded(const Ray& ray, float tMax) const;
+    virtual AABB bounds(float t) const;
 
     // Transformations
     glm::mat4 trans;
     glm::mat4 invtrans;
 
-    glm::mat4 m_originalTrans;
     std::vector<Animation*> m_animations;
 
     std::list<SceneNode*> children;
@@ -19,43 +19,28 @@ Light::Light()
 
 //---------------------------------------------------------------------------------------
 /**
- * animateLight is used to translate light position based on the attached animation
+ * positionAt computes the position of the light translated by the attached animation
  * @param t The frame time to calculate the translation
+ * @return Position of the light at time t
  */
-void Light::animateLight(const float t)
+glm::vec3 Light::positionAt(const float t) const
 {
-    // Store the transformation matrix before animation so we can reset it
-    m_originalPosition = m_position;
-
     // Translations
-    if (m_animation.m_type == AnimationType::Translate)
+    if (m_animation.m_type != AnimationType::Translate ||
+        t < m_animation.m_start) // Stop if this animation is not reached yet
     {
-        if (t < m_animation.m_start) // Stop if this animation is not reached yet
-        {
-            return;
-        }
-        else if (t > m_animation.m_end) // Full translation if animation is completed
-        {
-            float deltaT = m_animation.m_end - m_animation.m_start;
-            glm::vec3 trans = m_animation.m_animation(deltaT);
-            m_position = trans + m_position;
-        }
-        else // We are in the middle of this animation
-        {
-            float deltaT = t - m_animation.m_start;
-            glm::vec3 trans = m_animation.m_animation(deltaT);
-            m_position = trans + m_position;
-        }
+        return m_position;
+    }
+    else if (t > m_animation.m_end) // Full translation if animation is completed
+    {
+        float deltaT = m_animation.m_end - m_animation.m_start;
+        return m_animation.m_animation(deltaT) + m_position;
+    }
+    else // We are in the middle of this animation
+    {
+        float deltaT = t - m_animation.m_start;
+        return m_animation.m_animation(deltaT) + m_position;
     }
-}
-
-//---------------------------------------------------------------------------------------
-/**
- * resetAnimation resets the light position to the original position
- */
-void Light::resetAnimation()
-{
-    m_position = m_originalPosition;
 }
 
 //---------------------------------------------------------------------------------------
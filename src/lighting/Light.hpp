@@ -20,13 +20,10 @@ class Light {
 public:
     Light();
 
-    void animateLight(float t);
-
-    void resetAnimation();
+    [[nodiscard]] glm::vec3 positionAt(float t) const;
 
     glm::vec3 m_colour;
     glm::vec3 m_position;
-    glm::vec3 m_originalPosition;
     double m_falloff[3]{};
 
     Animation m_animation;
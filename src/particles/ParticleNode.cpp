@@ -1,5 +1,8 @@
 #include "ParticleNode.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <random>
 
 #include <glm/gtx/io.hpp>
@@ -81,13 +84,56 @@ ParticleNode::ParticleNode(
 
 //---------------------------------------------------------------------------------------
 /**
- * createParticle spawns a new particle at a random point on the spawn plane.
- * @param currFrame Current frame of the animation
+ * Copy of a particle system holding the particles alive in a frame, which are the ones
+ * spawned in the frames before it that have not expired yet. Frames can be evaluated in
+ * any order, and the copy does not change while the frame is traced.
+ * @param system Particle system of the scene
+ * @param currFrame Frame the particles are alive in
  */
-void ParticleNode::createParticle(const int currFrame)
+ParticleNode::ParticleNode(const ParticleNode& system, const int currFrame)
+    : SceneNode(system.m_name),
+      m_pos(system.m_pos),
+      m_area(system.m_area),
+      m_boundingBox(system.m_boundingBox),
+      m_spawnRate(system.m_spawnRate),
+      m_particleDirection(system.m_particleDirection),
+      m_firstFrame(system.m_firstFrame),
+      m_particleRadius(system.m_particleRadius),
+      m_particleLifeSpan(system.m_particleLifeSpan),
+      m_particleDisplacement(system.m_particleDisplacement),
+      m_particleMaterial(system.m_particleMaterial)
 {
-    // Initialize with random seed
-    std::mt19937 randomEngine(std::random_device{}());
+    m_nodeType = NodeType::ParticleNode;
+
+    // Particles expire at the start of the frame their life span ends in, so only the
+    // ones spawned in the last lifeSpan frames are left. A negative life span never ends
+    const int lifeSpan = static_cast<int>(m_particleLifeSpan);
+    const int firstSpawn = lifeSpan >= 0 ? std::max(m_firstFrame, currFrame - lifeSpan + 1)
+                                         : m_firstFrame;
+    for (int frame = firstSpawn; frame <= currFrame; frame++)
+    {
+        for (int i = 0; i < m_spawnRate; i++)
+        {
+            m_particles.push_back(createParticle(frame, i));
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * createParticle spawns a new particle at a random point on the spawn plane. The point
+ * only depends on the system, frame and index, so every render of a frame, in any
+ * process, has the same particles.
+ * @param currFrame Frame the particle is spawned in
+ * @param index Index of the particle among the ones spawned this frame
+ * @return Particle, moving from its spawn point over its life span
+ */
+NonhierSphere ParticleNode::createParticle(const int currFrame, const int index) const
+{
+    // Initialize with a seed for this particle
+    std::seed_seq seed{static_cast<uint32_t>(std::hash<std::string>{}(m_name)),
+                       static_cast<uint32_t>(currFrame), static_cast<uint32_t>(index)};
+    std::mt19937 randomEngine(seed);
     std::uniform_real_distribution<float> m_distribution(0.0f, 1.0f);
 
     // Generate a random position on the starting plane
@@ -131,83 +177,133 @@ void ParticleNode::createParticle(const int currFrame)
     p.m_startFrame = currFrame;
     p.m_endFrame = static_cast<int>(m_particleLifeSpan) + currFrame;
     p.m_translation = m_particleDisplacement;
-    m_particles.push_back(p);
+    return p;
 }
 
 //---------------------------------------------------------------------------------------
 /**
- * preprocessParticles spawns new particles and removes expired ones at the start of
- * each frame
- * @param currFrame Current frame of the animation
+ * setFirstFrame sets the frame the animation starts at, which particles are first
+ * spawned in.
+ * @param firstFrame First frame of the animation
  */
-void ParticleNode::preprocessParticles(const int currFrame)
+void ParticleNode::setFirstFrame(const int firstFrame)
 {
-    // Create particles this frame based on spawn rate
-    for (int i = 0; i < m_spawnRate; i++)
-    {
-        createParticle(currFrame);
-    }
+    m_firstFrame = firstFrame;
+}
 
-    // Clear out any particles that have expired
-    m_particles.remove_if(
-        [currFrame](const NonhierSphere& particle) {
-            return (particle.m_endFrame == currFrame);
-        }
-    );
+//---------------------------------------------------------------------------------------
+/**
+ * atTime makes a copy of the system with the particles alive in the frame at time t.
+ * @param t Frame time, the particles of its frame move on from there
+ * @param primitives Unused, particles are not shared
+ * @return Copy of the system
+ */
+std::unique_ptr<SceneNode> ParticleNode::atTime(const float t, FramePrimitives&) const
+{
+    return std::make_unique<ParticleNode>(*this, static_cast<int>(std::floor(t)));
 }
 
 //---------------------------------------------------------------------------------------
-// Checks
 /**
- * intersect if this particle system intersects with the ray. Since particles are
- * restricted to the bounding volume, only proceed if ray intersects with the bounding
- * volume.
+ * closestHit finds the closest particle hit before tMax. Since particles are restricted
+ * to the bounding volume, only proceed if ray intersects with the bounding volume.
  * @param ray Ray to check for intersection with the particle system
- * @return Intersection object containing information about the intersection
+ * @param tMax Parametric distance along the ray, shrunk to the closest hit found
+ * @param hit Set to the closest hit, with the index of the particle in hit.copy
+ * @return True if a particle was hit before tMax
  */
-Intersection ParticleNode::intersect(const Ray& ray) const
+bool ParticleNode::closestHit(const Ray& ray, float& tMax, Hit& hit) const
 {
-    Intersection intersection;
-
 #ifdef RENDER_PARTICLE_BOUNDING_VOLUMES
     // Render bounding volume instead of the particles
-    if (m_boundingBox.intersect(ray, intersection))
+    return m_boundingBox.closestHit(ray, tMax, hit);
+#else
+    // Bounding box check, if it doesn't hit, we skip
+    Intersection boxIntersection;
+    if (!m_boundingBox.intersect(ray, boxIntersection))
+    {
+        return false;
+    }
+
+    // Otherwise, check for intersection with all particles
+    bool found = false;
+    uint32_t index = 0;
+    for (const NonhierSphere& particle: m_particles)
     {
-        // Update intersection values of bounding box if ray intersected
-        intersection.m_material = static_cast<PhongMaterial*>(m_particleMaterial);
-        m_boundingBox.getUV(intersection.m_point, ray.time(), intersection.m_uv);
-        intersection.m_foundIntersection = true;
+        if (particle.closestHit(ray, tMax, hit))
+        {
+            hit.copy = index;
+            found = true;
+        }
+        index++;
     }
+    return found;
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * finalizeHit computes the point, normal, uv coordinates and material of a hit found by
+ * closestHit.
+ * @param ray Ray the hit was found with
+ * @param hit Hit on the particle in hit.copy
+ * @param intersection Set to the surface at the hit, in model coordinates
+ */
+void ParticleNode::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+#ifdef RENDER_PARTICLE_BOUNDING_VOLUMES
+    m_boundingBox.finalizeHit(ray, hit, intersection);
+#else
+    m_particles[hit.copy].finalizeHit(ray, hit, intersection);
+#endif
+    intersection.m_material = static_cast<PhongMaterial*>(m_particleMaterial);
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * occluded checks if any particle blocks the ray before tMax, stopping at the first one
+ * found instead of looking for the closest.
+ * @param ray Ray to check for intersection with the particle system
+ * @param tMax Parametric distance along the ray that the blockers must be closer than
+ * @return True if a particle is in the way
+ */
+bool ParticleNode::occluded(const Ray& ray, const float tMax) const
+{
+#ifdef RENDER_PARTICLE_BOUNDING_VOLUMES
+    return m_boundingBox.occluded(ray, tMax);
 #else
     // Bounding box check, if it doesn't hit, we skip
-    if (!m_boundingBox.intersect(ray, intersection))
+    Intersection boxIntersection;
+    if (!m_boundingBox.intersect(ray, boxIntersection))
     {
-        return intersection;
+        return false;
     }
 
-    // Otherwise, check for intersection with all particles
     for (const NonhierSphere& particle: m_particles)
     {
-        // If this node intersected with the ray, update intersection values
-        Intersection temp;
-        if (particle.intersect(ray, temp))
+        if (particle.occluded(ray, tMax))
         {
-            // Check if we have a closer intersection first
-            if (!intersection.m_foundIntersection ||
-                (intersection.m_foundIntersection &&
-                 (glm::length(temp.m_point - ray.transformedOrigin()) <
-                  glm::length(intersection.m_point - ray.transformedOrigin())))
-            )
-            {
-                // Found valid intersection, update material, normal, uv coordinates
-                intersection.m_material = dynamic_cast<PhongMaterial*>(m_particleMaterial);
-                particle.normal(intersection.m_point, ray.time(), intersection.m_normal);
-                particle.getUV(intersection.m_point, ray.time(), intersection.m_uv);
-                intersection.m_foundIntersection = true;
-            }
+            return true;
         }
     }
+    return false;
 #endif
+}
 
-    return intersection;
+//---------------------------------------------------------------------------------------
+/**
+ * bounds gets the bounding box of the particle system, which contains every particle.
+ * @param t Frame time to compute the bounds at
+ * @return Bounding volume of the particles, padded by the particle radius
+ */
+AABB ParticleNode::bounds(const float t) const
+{
+    AABB result = m_boundingBox.bounds(t);
+    result.min -= glm::vec3(m_particleRadius);
+    result.max += glm::vec3(m_particleRadius);
+    return result;
 }
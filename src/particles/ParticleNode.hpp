@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
+
 #include "geometry/GeometryNode.hpp"
 #include "geometry/SceneNode.hpp"
 #include "materials/Material.hpp"
@@ -44,10 +47,16 @@ public:
         Material* particleMaterial
     );
 
-    void createParticle(int currFrame);
-    void preprocessParticles(int currFrame);
+    ParticleNode(const ParticleNode& system, int currFrame);
+
+    [[nodiscard]] NonhierSphere createParticle(int currFrame, int index) const;
+    void setFirstFrame(int firstFrame);
 
-    [[nodiscard]] Intersection intersect(const Ray& ray) const override;
+    std::unique_ptr<SceneNode> atTime(float t, FramePrimitives& primitives) const override;
+    bool closestHit(const Ray& ray, float& tMax, Hit& hit) const override;
+    void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const override;
+    [[nodiscard]] bool occluded(const Ray& ray, float tMax) const override;
+    [[nodiscard]] AABB bounds(float t) const override;
 
 private:
     // Particle system configuration
@@ -55,8 +64,9 @@ private:
     float m_area; // Spawn area dimensions (a square starting from m_pos as one corner)
     NonhierBox m_boundingBox; // Particles restricted to this area, for optimization
     int m_spawnRate; // Rate in num particles per frame
-    std::list<NonhierSphere> m_particles; // List of particles active in this system
+    std::vector<NonhierSphere> m_particles; // Particles alive in the frame of a copy
     ParticleDirection m_particleDirection; // Just the axis that particles move
+    int m_firstFrame = 0; // Frame particles are first spawned in
 
     // Individual particle details
     float m_particleRadius;
@@ -45,6 +45,20 @@ Image::Image(const Image& other)
     std::memcpy(m_data, other.m_data, m_width * m_height * m_colorComponents * sizeof(double));
 }
 
+//---------------------------------------------------------------------------------------
+/*
+ * Move constructor.
+ */
+Image::Image(Image&& other) noexcept
+    : m_width(other.m_width),
+      m_height(other.m_height),
+      m_data(other.m_data)
+{
+    other.m_width = 0;
+    other.m_height = 0;
+    other.m_data = nullptr;
+}
+
 //---------------------------------------------------------------------------------------
 /*
  * Destructor.
@@ -82,6 +96,30 @@ Image& Image::operator=(const Image& other)
     return *this;
 }
 
+//---------------------------------------------------------------------------------------
+/*
+ * Move assignment operator.
+ */
+Image& Image::operator=(Image&& other) noexcept
+{
+    if (this == &other)
+    {
+        return *this;
+    }
+
+    delete [] m_data;
+
+    m_width = other.m_width;
+    m_height = other.m_height;
+    m_data = other.m_data;
+
+    other.m_width = 0;
+    other.m_height = 0;
+    other.m_data = nullptr;
+
+    return *this;
+}
+
 //---------------------------------------------------------------------------------------
 /*
  * width returns the width of the image.
@@ -183,27 +221,20 @@ bool Image::readPng(const std::string& filename)
  */
 bool Image::savePng(const std::string& filename) const
 {
-    std::vector<unsigned char> image;
-
-    image.resize(m_width * m_height * m_colorComponents);
-
-    for (uint y(0); y < m_height; y++)
+    // Pixels are stored row by row like in the PNG, so the colours are clamped and
+    // quantized in one flat loop without branches
+    const size_t numElements = m_width * m_height * m_colorComponents;
+    std::vector<unsigned char> image(numElements);
+    for (size_t i = 0; i < numElements; i++)
     {
-        for (uint x(0); x < m_width; x++)
-        {
-            for (uint i(0); i < m_colorComponents; ++i)
-            {
-                double color = m_data[m_colorComponents * (m_width * y + x) + i];
-                color = clampNormalize(color);
-                image[m_colorComponents * (m_width * y + x) + i] = static_cast<unsigned char>(255 * color);
-            }
-        }
+        image[i] = static_cast<unsigned char>(255 * clampNormalize(m_data[i]));
     }
 
     // Encode the image
     if (const unsigned error = lodepng::encode(filename, image, m_width, m_height, LCT_RGB))
     {
         std::cerr << "encoder error " << error << ": " << lodepng_error_text(error) << std::endl;
+        return false;
     }
 
     return true;
@@ -32,11 +32,17 @@ public:
     // Copy an image.
     Image(const Image& other);
 
+    // Take the data of an image, leaving it empty.
+    Image(Image&& other) noexcept;
+
     ~Image();
 
     // Copy the data from one image to another.
     Image& operator=(const Image& other);
 
+    // Move the data from one image to another, leaving it empty.
+    Image& operator=(Image&& other) noexcept;
+
     // Returns the width of the image.
     [[nodiscard]] uint width() const;
 
@@ -57,6 +63,7 @@ public:
 
     // Save this image into the PNG file with name 'filename'.
     // Warning: If 'filename' already exists, it will be overwritten.
+    // Returns false if the image could not be encoded or written.
     [[nodiscard]] bool savePng(const std::string& filename) const;
 
     [[nodiscard]] const double* data() const;
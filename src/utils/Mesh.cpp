@@ -1,149 +1,547 @@
 #include "Mesh.hpp"
 
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
 #include <glm/ext.hpp>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "core/Threads.hpp"
+#include "utils/MeshCache.hpp"
+
 //---------------------------------------------------------------------------------------
 /**
- * Custom constructor for Mesh that reads in an OBJ file and initializes the mesh
- * geometry.
+ * Custom constructor for Mesh that initializes the mesh geometry from an OBJ file. The
+ * geometry and its hierarchy are loaded from the cache next to the file if it is up to
+ * date, otherwise the file is parsed and the cache is written for the next run.
+ * @param name Path of the OBJ file
+ * @param logs Print the time loading the cache or building the hierarchy took
+ */
+Mesh::Mesh(const std::string& name, const bool logs)
+{
+    auto loadStart = std::chrono::steady_clock::now();
+
+    auto geometry = std::make_shared<MeshGeometry>();
+    m_geometry = geometry;
+
+    MeshSource source;
+    const bool sourceFound = source.read(name);
+    MeshCacheData cache;
+    if (sourceFound && loadMeshCache(source, cache))
+    {
+        geometry->vertices = std::move(cache.vertices);
+        geometry->faces.reserve(cache.indices.size() / 3);
+        for (size_t i = 0; i < cache.indices.size(); i += 3)
+        {
+            geometry->faces.emplace_back(cache.indices[i], cache.indices[i + 1],
+                                         cache.indices[i + 2]);
+        }
+        m_bvh.restore(std::move(cache.nodes), std::move(cache.primitiveIndices));
+
+        std::chrono::duration<double, std::milli> loadTime =
+            std::chrono::steady_clock::now() - loadStart;
+        if (logs)
+        {
+            std::cout << "Loaded " << geometry->faces.size() << " faces of " << name
+                      << " from cache in " << loadTime.count() << " ms" << std::endl;
+        }
+    }
+    else
+    {
+        readOBJ(name, *geometry);
+
+        // Build the bounding volume hierarchy over the faces, timed separately from loading
+        auto buildStart = std::chrono::steady_clock::now();
+        m_bvh.build(faceBounds(geometry->vertices), workerThreadCount(),
+                    TrianglePacket::WIDTH);
+        m_bvh.alignLeaves();
+        std::chrono::duration<double, std::milli> buildTime =
+            std::chrono::steady_clock::now() - buildStart;
+        if (logs)
+        {
+            std::cout << "Built hierarchy over " << geometry->faces.size() << " faces of "
+                      << name << " in " << buildTime.count() << " ms" << std::endl;
+        }
+
+        if (sourceFound)
+        {
+            cache.vertices = geometry->vertices;
+            cache.indices.reserve(3 * geometry->faces.size());
+            for (const Triangle& face: geometry->faces)
+            {
+                cache.indices.insert(cache.indices.end(), {face.v1, face.v2, face.v3});
+            }
+            cache.nodes = m_bvh.m_nodes;
+            cache.primitiveIndices = m_bvh.m_primitiveIndices;
+            if (!saveMeshCache(source, cache))
+            {
+                std::cerr << "Could not write the cache of " << name << std::endl;
+            }
+        }
+    }
+
+    // The copies made for each frame share the leaves of the hierarchy with this mesh
+    geometry->primitiveIndices = std::move(m_bvh.m_primitiveIndices);
+    m_bvh.m_primitiveIndices = {};
+
+    updateTriangles(geometry->vertices);
+
+    // Set bounding box dimensions
+    AABB bounds;
+    for (const glm::vec3& v: geometry->vertices)
+    {
+        bounds.extend(v);
+    }
+    glm::vec3 distance = bounds.max - bounds.min;
+    float size = std::max(distance.x, std::max(distance.y, distance.z));
+    m_boundingBox = NonhierBox(bounds.min, glm::vec3(size));
+    // Note: Bounding boxes need the same animation as the mesh
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * readOBJ parses the vertices and triangular faces of an OBJ file into geometry
  */
-Mesh::Mesh(const std::string& name)
+void Mesh::readOBJ(const std::string& name, MeshGeometry& geometry)
 {
     std::string code;
     double vx, vy, vz;
     size_t s1, s2, s3;
 
-    // Store minimum values for the bounding box
-    double min_x = std::numeric_limits<double>::max();
-    double min_y = std::numeric_limits<double>::max();
-    double min_z = std::numeric_limits<double>::max();
-    double max_x = -1.0f * std::numeric_limits<double>::max();
-    double max_y = -1.0f * std::numeric_limits<double>::max();
-    double max_z = -1.0f * std::numeric_limits<double>::max();
-
     std::ifstream ifs(name.c_str());
     while (ifs >> code)
     {
         if (code == "v")
         {
             ifs >> vx >> vy >> vz;
-            glm::vec3 v = glm::vec3(vx, vy, vz);
-            m_vertices.push_back(v);
-
-            min_x = std::min(min_x, vx);
-            min_y = std::min(min_y, vy);
-            min_z = std::min(min_z, vz);
-            max_x = std::max(max_x, vx);
-            max_y = std::max(max_y, vy);
-            max_z = std::max(max_z, vz);
+            geometry.vertices.emplace_back(vx, vy, vz);
         }
         else if (code == "f")
         {
             ifs >> s1 >> s2 >> s3;
-            m_faces.emplace_back(s1 - 1, s2 - 1, s3 - 1);
+            geometry.faces.emplace_back(static_cast<uint32_t>(s1 - 1),
+                                        static_cast<uint32_t>(s2 - 1),
+                                        static_cast<uint32_t>(s3 - 1));
         }
     }
+}
 
-    // Set bounding box dimensions
-    glm::vec3 max_point(max_x, max_y, max_z);
-    glm::vec3 min_point(min_x, min_y, min_z);
-    glm::vec3 distance = max_point - min_point;
-    float size = std::max(distance.x, std::max(distance.y, distance.z));
-    m_boundingBox = NonhierBox(min_point, glm::vec3(size));
-    // Note: Bounding boxes need the same animation as the mesh
+//---------------------------------------------------------------------------------------
+/**
+ * Constructor for the copy of a mesh made for the frame at time t, with the displacement
+ * map applied to every vertex and the hierarchy refit around the displaced faces. The
+ * vertices, faces and leaves of the hierarchy are shared with the mesh, only the triangle
+ * records and the boxes of the hierarchy are made for the frame.
+ * @param mesh Mesh to copy, as it is before displacement
+ * @param t Frame time to displace the vertices to
+ */
+Mesh::Mesh(const Mesh& mesh, const float t)
+    : Primitive(mesh),
+      m_geometry(mesh.m_geometry),
+      m_boundingBox(mesh.m_boundingBox),
+      m_bvh(mesh.m_bvh)
+{
+    const std::vector<glm::vec3>& vertices = m_geometry->vertices;
+    std::vector<glm::vec3> displacedVertices(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        displacedVertices[i] = m_displacementMap.m_vertexDisplacement(vertices[i], t);
+    }
+
+    m_bvh.refit(faceBounds(displacedVertices), m_geometry->primitiveIndices);
+    updateTriangles(displacedVertices);
 }
 
 //---------------------------------------------------------------------------------------
 /*
- * intersect computes ray-mesh intersection and updates intersection if necessary
+ * atTime makes a copy of the mesh for the frame at time t if it has a displacement map.
+ * Meshes without one are the same in every frame and have no copy.
  */
-bool Mesh::intersect(const Ray& ray, Intersection& intersection) const
+std::unique_ptr<Primitive> Mesh::atTime(const float t) const
 {
-#ifdef RENDER_BOUNDING_VOLUMES
-// Render bounding volume instead of the mesh
-// return m_boundingBox.intersect(ray, intersection);
-#endif
+    if (m_displacementMap.m_type != AnimationType::VertexDisplacement)
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<Mesh>(*this, t);
+}
 
-    // Bounding box check, if it doesn't hit, we skip
-    Intersection temp;
-    if (!m_boundingBox.intersect(ray, temp))
+//---------------------------------------------------------------------------------------
+/*
+ * faceBounds computes the bounding box of every face of the mesh for the given vertices
+ */
+std::vector<AABB> Mesh::faceBounds(const std::vector<glm::vec3>& vertices) const
+{
+    std::vector<AABB> result;
+    result.reserve(m_geometry->faces.size());
+    for (const Triangle& face: m_geometry->faces)
     {
-        return false;
+        AABB bounds;
+        bounds.extend(vertices[face.v1]);
+        bounds.extend(vertices[face.v2]);
+        bounds.extend(vertices[face.v3]);
+        result.push_back(bounds);
     }
+    return result;
+}
 
-    // Iterate through each triangular face on the mesh
-    bool intersectionFound = false;
-    glm::vec3 intersectionPoint;
-    glm::vec3 intersectionNormal;
-    glm::vec2 intersectionUV;
-    for (const auto& face: m_faces)
+//---------------------------------------------------------------------------------------
+/*
+ * updateTriangles recomputes the triangle records of every face for the given vertices
+ */
+void Mesh::updateTriangles(const std::vector<glm::vec3>& vertices)
+{
+    const std::vector<Triangle>& faces = m_geometry->faces;
+    m_triangles.resize(faces.size());
+    for (size_t i = 0; i < faces.size(); i++)
     {
-        // Get the vertices of this face
-        glm::vec3 v1 = m_vertices[face.v1];
-        glm::vec3 v2 = m_vertices[face.v2];
-        glm::vec3 v3 = m_vertices[face.v3];
+        const glm::vec3& v1 = vertices[faces[i].v1];
+        const glm::vec3& v2 = vertices[faces[i].v2];
+        const glm::vec3& v3 = vertices[faces[i].v3];
 
-        // Apply displacement map if exists
-        if (m_displacementMap.m_type == AnimationType::VertexDisplacement)
+        TriangleRecord& triangle = m_triangles[i];
+        triangle.v0 = v1;
+        triangle.edge1 = v2 - v1;
+        triangle.edge2 = v3 - v1;
+        triangle.normal = glm::normalize(glm::cross(triangle.edge1, triangle.edge2));
+    }
+
+    updatePackets();
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * updatePackets copies the triangle records into the packets of the leaves of the
+ * hierarchy, whose leaves are aligned to the width of a packet
+ */
+void Mesh::updatePackets()
+{
+    const std::vector<uint32_t>& primitiveIndices = m_geometry->primitiveIndices;
+    m_packets.assign(primitiveIndices.size() / TrianglePacket::WIDTH, TrianglePacket{});
+    for (size_t i = 0; i < primitiveIndices.size(); i++)
+    {
+        if (primitiveIndices[i] != WideBVH::PADDING_INDEX)
         {
-            v1 = m_displacementMap.m_vertexDisplacement(v1, ray.time());
-            v2 = m_displacementMap.m_vertexDisplacement(v2, ray.time());
-            v3 = m_displacementMap.m_vertexDisplacement(v3, ray.time());
+            m_packets[i / TrianglePacket::WIDTH].setTriangle(
+                static_cast<int>(i % TrianglePacket::WIDTH),
+                m_triangles[primitiveIndices[i]], primitiveIndices[i]);
         }
+    }
+}
 
-        // Get position of point at this frame after animation
-        glm::vec3 updatedPos;
-        getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+//---------------------------------------------------------------------------------------
+/**
+ * setTriangle stores a face in lane i.
+ */
+void TrianglePacket::setTriangle(
+    const int i,
+    const TriangleRecord& triangle,
+    const uint32_t primitiveIndex
+)
+{
+    v0X[i] = triangle.v0.x;
+    v0Y[i] = triangle.v0.y;
+    v0Z[i] = triangle.v0.z;
+    edge1X[i] = triangle.edge1.x;
+    edge1Y[i] = triangle.edge1.y;
+    edge1Z[i] = triangle.edge1.z;
+    edge2X[i] = triangle.edge2.x;
+    edge2Y[i] = triangle.edge2.y;
+    edge2Z[i] = triangle.edge2.z;
+    primitive[i] = primitiveIndex;
+}
 
-        glm::vec3 r = ray.transformedOrigin() - v1 - updatedPos;
-        glm::vec3 x = v2 - v1;
-        glm::vec3 y = v3 - v1;
-        glm::vec3 z = -1.0f * ray.transformedDirection();
+//---------------------------------------------------------------------------------------
+/**
+ * getTriangle retrieves the face in lane i, without its normal.
+ */
+TriangleRecord TrianglePacket::getTriangle(const int i) const
+{
+    return {glm::vec3(v0X[i], v0Y[i], v0Z[i]),
+            glm::vec3(edge1X[i], edge1Y[i], edge1Z[i]),
+            glm::vec3(edge2X[i], edge2Y[i], edge2Z[i]),
+            glm::vec3(0.0f)};
+}
 
-        float D = glm::determinant(glm::transpose(glm::mat3(x, y, z)));
-        float D_1 = glm::determinant(glm::transpose(glm::mat3(r, y, z)));
-        float D_2 = glm::determinant(glm::transpose(glm::mat3(x, r, z)));
-        float D_3 = glm::determinant(glm::transpose(glm::mat3(x, y, r)));
+//---------------------------------------------------------------------------------------
+/**
+ * intersect tests the ray against every face of the packet at once with the
+ * Moller-Trumbore algorithm, keeping the closest hit.
+ * @param origin Origin of the ray
+ * @param direction Direction of the ray, not necessarily normalized
+ * @param tMax Closest hit distance so far, shrunk if a face is hit before it
+ * @param hit Set to the closest hit on the packet if it is before tMax
+ * @return True if any face is hit in front of the ray origin and before tMax
+ */
+bool TrianglePacket::intersect(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    float& tMax,
+    TriangleHit& hit
+) const
+{
+#if defined(__SSE2__)
+    const __m128 dx = _mm_set1_ps(direction.x);
+    const __m128 dy = _mm_set1_ps(direction.y);
+    const __m128 dz = _mm_set1_ps(direction.z);
+    const __m128 e1x = _mm_load_ps(edge1X);
+    const __m128 e1y = _mm_load_ps(edge1Y);
+    const __m128 e1z = _mm_load_ps(edge1Z);
+    const __m128 e2x = _mm_load_ps(edge2X);
+    const __m128 e2y = _mm_load_ps(edge2Y);
+    const __m128 e2z = _mm_load_ps(edge2Z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+
+    // p = direction x edge2, and the determinant is edge1 . p
+    const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                                  _mm_mul_ps(e1z, pz));
+    const __m128 invDet = _mm_div_ps(one, det);
+
+    const __m128 rx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_load_ps(v0X));
+    const __m128 ry = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_load_ps(v0Y));
+    const __m128 rz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_load_ps(v0Z));
+    const __m128 u = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, px), _mm_mul_ps(ry, py)), _mm_mul_ps(rz, pz)),
+        invDet);
+
+    // Comparisons with NaN fail, so parallel rays and empty lanes drop out here as well
+    __m128 valid = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one));
+    if (_mm_movemask_ps(valid) == 0)
+    {
+        return false;
+    }
+
+    // q = r x edge1
+    const __m128 qx = _mm_sub_ps(_mm_mul_ps(ry, e1z), _mm_mul_ps(rz, e1y));
+    const __m128 qy = _mm_sub_ps(_mm_mul_ps(rz, e1x), _mm_mul_ps(rx, e1z));
+    const __m128 qz = _mm_sub_ps(_mm_mul_ps(rx, e1y), _mm_mul_ps(ry, e1x));
+    const __m128 v = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)),
+        invDet);
+    const __m128 t = _mm_mul_ps(
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+        invDet);
 
-        float beta = D_1 / D;
-        float gamma = D_2 / D;
-        float t = D_3 / D;
+    valid = _mm_and_ps(valid, _mm_cmpneq_ps(det, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+    valid = _mm_and_ps(valid, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
 
-        // Check for intersection
-        glm::vec3 p;
-        if ((beta >= 0) && (gamma >= 0) && (beta + gamma <= 1.0f) && (t >= 0))
+    int mask = _mm_movemask_ps(valid);
+    if (mask == 0)
+    {
+        return false;
+    }
+
+    alignas(16) float laneT[WIDTH], laneU[WIDTH], laneV[WIDTH];
+    _mm_store_ps(laneT, t);
+    _mm_store_ps(laneU, u);
+    _mm_store_ps(laneV, v);
+
+    // The first of equally close faces wins, as if they were tested one at a time
+    for (int i = 0; mask != 0; i++, mask >>= 1)
+    {
+        if ((mask & 1) && laneT[i] < tMax)
         {
-            p = ray.transformedOrigin() + t * ray.transformedDirection();
+            tMax = laneT[i];
+            hit = {laneT[i], laneU[i], laneV[i], primitive[i]};
         }
-        else
+    }
+    return true;
+#else
+    bool found = false;
+    for (int i = 0; i < WIDTH; i++)
+    {
+        float t, u, v;
+        if (getTriangle(i).intersect(origin, direction, tMax, t, u, v))
         {
-            continue;
+            tMax = t;
+            hit = {t, u, v, primitive[i]};
+            found = true;
         }
+    }
+    return found;
+#endif
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * intersect computes ray-triangle intersection with the Moller-Trumbore algorithm.
+ * @param origin Origin of the ray
+ * @param direction Direction of the ray, not necessarily normalized
+ * @param tMax Hits at or past this distance along the ray are ignored
+ * @param t Set to the distance along the ray of the hit
+ * @param u Set to the barycentric coordinate of the hit along edge1
+ * @param v Set to the barycentric coordinate of the hit along edge2
+ * @return True if the ray hits the triangle in front of its origin and before tMax
+ */
+bool TriangleRecord::intersect(
+    const glm::vec3& origin,
+    const glm::vec3& direction,
+    const float tMax,
+    float& t,
+    float& u,
+    float& v
+) const
+{
+    // Rays parallel to the plane of the triangle never hit it
+    const glm::vec3 p = glm::cross(direction, edge2);
+    const float det = glm::dot(edge1, p);
+    if (det == 0.0f)
+    {
+        return false;
+    }
+    const float invDet = 1.0f / det;
+
+    const glm::vec3 r = origin - v0;
+    u = glm::dot(r, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+    {
+        return false;
+    }
+
+    const glm::vec3 q = glm::cross(r, edge1);
+    v = glm::dot(direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+    {
+        return false;
+    }
+
+    t = glm::dot(edge2, q) * invDet;
+    return t >= 0.0f && t < tMax;
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * intersect computes ray-mesh intersection and updates intersection if necessary
+ */
+bool Mesh::intersect(const Ray& ray, Intersection& intersection) const
+{
+#ifdef RENDER_BOUNDING_VOLUMES
+// Render bounding volume instead of the mesh
+// return m_boundingBox.intersect(ray, intersection);
+#endif
+
+    float tMax = std::numeric_limits<float>::max();
+    Hit hit{};
+    if (!closestHit(ray, tMax, hit))
+    {
+        return false;
+    }
+
+    finalizeHit(ray, hit, intersection);
+    return true;
+}
 
-        // If an intersection has already been found check which one is closer
-        if (
-            !intersectionFound ||
-            glm::length(p - ray.transformedOrigin()) < glm::length(intersectionPoint - ray.transformedOrigin())
-        )
+//---------------------------------------------------------------------------------------
+/*
+ * closestHit finds the closest face hit before the parametric distance tMax, recording
+ * only the face and the barycentric coordinates of the hit
+ */
+bool Mesh::closestHit(const Ray& ray, float& tMax, Hit& hit) const
+{
+    // Get position of point at this frame after animation, and move the ray instead
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+    const glm::vec3 origin = ray.transformedOrigin() - updatedPos;
+    const glm::vec3 direction = ray.transformedDirection();
+
+    TriangleHit triangleHit{};
+    auto intersectLeaf = [&](const uint32_t first, const uint32_t count, float& tMaxLeaf) {
+        bool found = false;
+        for (uint32_t i = first; i < first + count; i += TrianglePacket::WIDTH)
         {
-            intersectionPoint = p;
-            intersectionUV = glm::vec2(beta + gamma, beta);
-            intersectionNormal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
+            found |= m_packets[i / TrianglePacket::WIDTH].intersect(origin, direction,
+                                                                    tMaxLeaf, triangleHit);
         }
-        intersectionFound = true;
+        return found;
+    };
+
+    // Walk the hierarchy, skipping subtrees behind the closest hit so far
+    float closestT = tMax;
+    if (!m_bvh.traverseLeaves(origin, direction, closestT, intersectLeaf))
+    {
+        return false;
     }
 
-    // Output result
-    if (intersectionFound)
+    tMax = closestT;
+    hit.t = triangleHit.t;
+    hit.primitive = triangleHit.primitive;
+    hit.barycentric = glm::vec2(triangleHit.u, triangleHit.v);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * finalizeHit computes the point, normal and uv coordinates of a hit found by closestHit
+ */
+void Mesh::finalizeHit(
+    const Ray& ray,
+    const Hit& hit,
+    Intersection& intersection
+) const
+{
+    intersection.m_point = ray.transformedOrigin() + hit.t * ray.transformedDirection();
+    intersection.m_normal = m_triangles[hit.primitive].normal;
+    intersection.m_uv = glm::vec2(hit.barycentric.x + hit.barycentric.y, hit.barycentric.x);
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * occluded checks if any face blocks the ray before the parametric distance tMax. The
+ * walk stops at the first face hit, whichever it is
+ */
+bool Mesh::occluded(const Ray& ray, float tMax) const
+{
+    glm::vec3 updatedPos;
+    getFramePosition(ray.time(), glm::vec3(0.0f), updatedPos);
+    const glm::vec3 origin = ray.transformedOrigin() - updatedPos;
+    const glm::vec3 direction = ray.transformedDirection();
+
+    TriangleHit hit{};
+    return m_bvh.traverseLeaves(
+        origin, direction, tMax,
+        [&](const uint32_t first, const uint32_t count, float& tMaxLeaf) {
+            for (uint32_t i = first; i < first + count; i += TrianglePacket::WIDTH)
+            {
+                if (m_packets[i / TrianglePacket::WIDTH].intersect(origin, direction,
+                                                                   tMaxLeaf, hit))
+                {
+                    tMaxLeaf = -1.0f; // Any hit will do, end the walk
+                    return true;
+                }
+            }
+            return false;
+        });
+}
+
+//---------------------------------------------------------------------------------------
+/*
+ * bounds computes the bounding box of the mesh at time t
+ */
+AABB Mesh::bounds(const float t) const
+{
+    if (m_bvh.isEmpty())
     {
-        intersection.m_point = intersectionPoint;
-        intersection.m_normal = intersectionNormal;
-        intersection.m_uv = intersectionUV;
+        return {};
     }
-    return intersectionFound;
+
+    glm::vec3 updatedPos;
+    getFramePosition(t, glm::vec3(0.0f), updatedPos);
+
+    // The hierarchy has been refit to the displaced faces of this frame
+    const AABB& result = m_bvh.bounds();
+    return {result.min + updatedPos, result.max + updatedPos};
 }
 
 //---------------------------------------------------------------------------------------
@@ -154,9 +552,9 @@ std::ostream& operator<<(std::ostream& out, const Mesh& mesh)
 {
     out << "mesh {\n";
 
-    for (size_t idx = 0; idx < mesh.m_faces.size(); ++idx)
+    for (size_t idx = 0; idx < mesh.m_geometry->faces.size(); ++idx)
     {
-        const Triangle& v = mesh.m_faces[idx];
+        const Triangle& v = mesh.m_geometry->faces[idx];
         out << "  " << idx << ": {"
             << v.v1 << " " << v.v2 << " " << v.v3
             << "}\n";
@@ -6,10 +6,14 @@
 
 #pragma once
 
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <vector>
 
 #include <glm/glm.hpp>
 
+#include "acceleration/WideBVH.hpp"
 #include "core/Ray.hpp"
 #include "geometry/Primitive.hpp"
 
@@ -17,33 +21,114 @@
 // #define RENDER_BOUNDING_VOLUMES
 
 /**
- * Triangle struct defines a triangular face for a mesh.
+ * Triangle struct defines a triangular face for a mesh by the indices of its vertices.
  */
 struct Triangle {
-    size_t v1;
-    size_t v2;
-    size_t v3;
+    uint32_t v1;
+    uint32_t v2;
+    uint32_t v3;
 
-    Triangle(size_t pv1, size_t pv2, size_t pv3)
+    Triangle(uint32_t pv1, uint32_t pv2, uint32_t pv3)
         : v1(pv1),
           v2(pv2),
           v3(pv3)
     {}
 };
 
+/**
+ * TriangleRecord holds a face of a mesh in the form the intersection test uses, so the
+ * edges and normal are computed once per frame instead of once per ray.
+ */
+struct TriangleRecord {
+    glm::vec3 v0;     // First vertex
+    glm::vec3 edge1;  // Second vertex minus the first
+    glm::vec3 edge2;  // Third vertex minus the first
+    glm::vec3 normal; // Unit geometric normal
+
+    bool intersect(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float tMax,
+        float& t,
+        float& u,
+        float& v
+    ) const;
+};
+
+/**
+ * TriangleHit is the closest hit found on a mesh, with the barycentric coordinates of the
+ * hit along the edges of the triangle.
+ */
+struct TriangleHit {
+    float t;
+    float u;
+    float v;
+    uint32_t primitive; // Index of the face that was hit
+};
+
+/**
+ * TrianglePacket holds the faces of a leaf of the mesh hierarchy as a structure of arrays,
+ * so a ray is tested against all of them at once with SSE. Unused lanes are left zeroed,
+ * which makes degenerate triangles that are never hit.
+ */
+struct alignas(16) TrianglePacket {
+    static const int WIDTH = WideBVHNode::WIDTH;
+
+    float v0X[WIDTH], v0Y[WIDTH], v0Z[WIDTH];
+    float edge1X[WIDTH], edge1Y[WIDTH], edge1Z[WIDTH];
+    float edge2X[WIDTH], edge2Y[WIDTH], edge2Z[WIDTH];
+    uint32_t primitive[WIDTH];
+
+    void setTriangle(int i, const TriangleRecord& triangle, uint32_t primitiveIndex);
+    [[nodiscard]] TriangleRecord getTriangle(int i) const;
+
+    bool intersect(
+        const glm::vec3& origin,
+        const glm::vec3& direction,
+        float& tMax,
+        TriangleHit& hit
+    ) const;
+};
+
+/**
+ * MeshGeometry holds the parts of a mesh that are the same in every frame, which the copies
+ * of the mesh made for each frame share instead of copying.
+ */
+struct MeshGeometry {
+    std::vector<glm::vec3> vertices; // Vertices before any displacement
+    std::vector<Triangle> faces;
+    std::vector<uint32_t> primitiveIndices; // Faces in the leaves of the hierarchy
+};
+
 /*
  * Mesh class defines a polygonal mesh composed of triangular faces.
  */
 class Mesh : public Primitive {
 public:
-    explicit Mesh(const std::string& name);
+    explicit Mesh(const std::string& name, bool logs = true);
+    Mesh(const Mesh& mesh, float t);
 
     bool intersect(const Ray& ray, Intersection& intersection) const override;
+    bool closestHit(const Ray& ray, float& tMax, Hit& hit) const override;
+    void finalizeHit(const Ray& ray, const Hit& hit, Intersection& intersection) const override;
+    bool occluded(const Ray& ray, float tMax) const override;
+    AABB bounds(float t) const override;
+    [[nodiscard]] std::unique_ptr<Primitive> atTime(float t) const override;
 
 private:
-    std::vector<glm::vec3> m_vertices;
-    std::vector<Triangle> m_faces;
+    static void readOBJ(const std::string& name, MeshGeometry& geometry);
+    std::vector<AABB> faceBounds(const std::vector<glm::vec3>& vertices) const;
+    void updateTriangles(const std::vector<glm::vec3>& vertices);
+    void updatePackets();
+
+    std::shared_ptr<const MeshGeometry> m_geometry;
+    std::vector<TriangleRecord> m_triangles; // Faces with the vertices of this frame
+    std::vector<TrianglePacket> m_packets; // m_triangles grouped by the leaves of m_bvh
     NonhierBox m_boundingBox;
 
+    // Hierarchy over the faces, refit to the displaced faces in copies. Only the nodes are
+    // kept here, the primitive indices of the leaves are in m_geometry
+    WideBVH m_bvh;
+
     friend std::ostream& operator<<(std::ostream& out, const Mesh& mesh);
 };
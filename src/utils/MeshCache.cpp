@@ -0,0 +1,278 @@
+#include "MeshCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MESH_CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Identifies a mesh cache file, followed by the version of its layout
+const char MESH_CACHE_MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+const uint32_t MESH_CACHE_VERSION = 2;
+
+// Every section of the cache starts at a multiple of this, so nodes can be used in place
+const size_t MESH_CACHE_ALIGNMENT = 16;
+
+/**
+ * MeshCacheHeader is stored at the start of a cache file. It is followed by the source
+ * path, vertices, vertex indices, nodes and primitive indices, each section aligned to
+ * MESH_CACHE_ALIGNMENT.
+ */
+struct MeshCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize; // Size of a WideBVHNode, so caches from other builds are rejected
+    int64_t modifiedTime;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t pathLength;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t nodeCount;
+    uint64_t primitiveIndexCount;
+};
+
+/**
+ * MeshCacheLayout holds the offset of every section of a cache file.
+ */
+struct MeshCacheLayout {
+    size_t path;
+    size_t vertices;
+    size_t indices;
+    size_t nodes;
+    size_t primitiveIndices;
+    size_t end;
+
+    explicit MeshCacheLayout(const MeshCacheHeader& header)
+    {
+        auto align = [](const size_t offset) {
+            return (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT *
+                   MESH_CACHE_ALIGNMENT;
+        };
+
+        path = align(sizeof(MeshCacheHeader));
+        vertices = align(path + header.pathLength);
+        indices = align(vertices + header.vertexCount * sizeof(glm::vec3));
+        nodes = align(indices + header.indexCount * sizeof(uint32_t));
+        primitiveIndices = align(nodes + header.nodeCount * sizeof(WideBVHNode));
+        end = primitiveIndices + header.primitiveIndexCount * sizeof(uint32_t);
+    }
+};
+
+/**
+ * MappedFile gives read only access to the contents of a file, memory mapped where
+ * supported and read into memory otherwise.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef MESH_CACHE_MMAP
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat status{};
+        if (fstat(fd, &status) == 0 && status.st_size > 0)
+        {
+            void* mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                m_data = static_cast<const char*>(mapping);
+                m_size = status.st_size;
+                m_mapped = true;
+            }
+        }
+        close(fd);
+#else
+        std::ifstream ifs(path, std::ios::binary);
+        m_buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#ifdef MESH_CACHE_MMAP
+        if (m_mapped)
+        {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+#endif
+    }
+
+    [[nodiscard]] const char* data() const { return m_data; }
+    [[nodiscard]] size_t size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<char> m_buffer;
+};
+
+//---------------------------------------------------------------------------------------
+/**
+ * read identifies the OBJ file at sourcePath by its modification time, size and a
+ * 64 bit FNV-1a hash of its contents.
+ * @param sourcePath Path of the OBJ file
+ * @return False if the file could not be read
+ */
+bool MeshSource::read(const std::string& sourcePath)
+{
+    std::error_code error;
+    const auto time = std::filesystem::last_write_time(sourcePath, error);
+    if (error)
+    {
+        return false;
+    }
+
+    MappedFile file(sourcePath);
+    if (file.data() == nullptr)
+    {
+        return false;
+    }
+
+    path = sourcePath;
+    modifiedTime = time.time_since_epoch().count();
+    size = file.size();
+    hash = 14695981039346656037ull;
+    for (size_t i = 0; i < file.size(); i++)
+    {
+        hash = (hash ^ static_cast<unsigned char>(file.data()[i])) * 1099511628211ull;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * loadMeshCache reads the cache of an OBJ file, if it exists and was made from the same
+ * contents of the file.
+ * @param source Identity of the OBJ file
+ * @param data Set to the cached geometry if the cache is valid
+ * @return True if data was loaded from the cache
+ */
+bool loadMeshCache(const MeshSource& source, MeshCacheData& data)
+{
+    MappedFile file(source.path + MESH_CACHE_EXTENSION);
+    if (file.size() < sizeof(MeshCacheHeader))
+    {
+        return false;
+    }
+
+    MeshCacheHeader header{};
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != MESH_CACHE_VERSION ||
+        header.nodeSize != sizeof(WideBVHNode) ||
+        header.modifiedTime != source.modifiedTime ||
+        header.size != source.size ||
+        header.hash != source.hash ||
+        header.pathLength != source.path.size() ||
+        header.indexCount % 3 != 0)
+    {
+        return false;
+    }
+
+    const MeshCacheLayout layout(header);
+    if (file.size() != layout.end ||
+        source.path.compare(0, source.path.size(), file.data() + layout.path,
+                            header.pathLength) != 0)
+    {
+        return false;
+    }
+
+    // Every section is a plain array, so it is copied out as is
+    auto copySection = [&file](auto& section, const size_t offset, const size_t count) {
+        section.resize(count);
+        std::memcpy(section.data(), file.data() + offset, count * sizeof(section[0]));
+    };
+    copySection(data.vertices, layout.vertices, header.vertexCount);
+    copySection(data.indices, layout.indices, header.indexCount);
+    copySection(data.nodes, layout.nodes, header.nodeCount);
+    copySection(data.primitiveIndices, layout.primitiveIndices, header.primitiveIndexCount);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------
+/**
+ * saveMeshCache writes the cache of an OBJ file next to it. Every process writes its own
+ * temporary file first and renames it over the cache, so processes loading the same mesh
+ * at once, like the workers of a render job, never see a partially written cache.
+ * @param source Identity of the OBJ file
+ * @param data Geometry parsed from the OBJ file
+ * @return False if the cache could not be written
+ */
+bool saveMeshCache(const MeshSource& source, const MeshCacheData& data)
+{
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.nodeSize = sizeof(WideBVHNode);
+    header.modifiedTime = source.modifiedTime;
+    header.size = source.size;
+    header.hash = source.hash;
+    header.pathLength = source.path.size();
+    header.vertexCount = data.vertices.size();
+    header.indexCount = data.indices.size();
+    header.nodeCount = data.nodes.size();
+    header.primitiveIndexCount = data.primitiveIndices.size();
+
+    const MeshCacheLayout layout(header);
+    std::vector<char> buffer(layout.end, 0);
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    std::memcpy(buffer.data() + layout.path, source.path.data(), source.path.size());
+    std::memcpy(buffer.data() + layout.vertices, data.vertices.data(),
+                data.vertices.size() * sizeof(glm::vec3));
+    std::memcpy(buffer.data() + layout.indices, data.indices.data(),
+                data.indices.size() * sizeof(uint32_t));
+    std::memcpy(buffer.data() + layout.nodes, data.nodes.data(),
+                data.nodes.size() * sizeof(WideBVHNode));
+    std::memcpy(buffer.data() + layout.primitiveIndices, data.primitiveIndices.data(),
+                data.primitiveIndices.size() * sizeof(uint32_t));
+
+    const std::string cachePath = source.path + MESH_CACHE_EXTENSION;
+#if defined(__unix__) || defined(__APPLE__)
+    const std::string tempPath = cachePath + "." + std::to_string(getpid()) + ".tmp";
+#else
+    const std::string tempPath = cachePath + "." + std::to_string(std::random_device()()) +
+                                 ".tmp";
+#endif
+    {
+        std::ofstream ofs(tempPath, std::ios::binary | std::ios::trunc);
+        ofs.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (!ofs)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    // Renaming over an existing file fails on some platforms
+    if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+    {
+        std::remove(cachePath.c_str());
+        if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
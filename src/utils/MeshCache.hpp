@@ -0,0 +1,46 @@
+/*
+ * Name: MeshCache
+ * Description: Binary cache of a parsed OBJ mesh and its bounding volume hierarchy,
+ * stored next to the OBJ file. The cache is keyed by the path, modification time, size
+ * and content hash of the OBJ, and is laid out so it can be memory mapped and copied out
+ * without any parsing.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "acceleration/WideBVH.hpp"
+
+// Appended to the path of an OBJ file to get the path of its cache
+const std::string MESH_CACHE_EXTENSION = ".meshcache";
+
+/**
+ * MeshSource identifies the contents of an OBJ file, so a stale cache can be detected.
+ */
+struct MeshSource {
+    std::string path;
+    int64_t modifiedTime = 0;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+
+    bool read(const std::string& sourcePath);
+};
+
+/**
+ * MeshCacheData is the geometry held by a cache, with the faces stored as three 32 bit
+ * vertex indices each.
+ */
+struct MeshCacheData {
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<WideBVHNode> nodes;
+    std::vector<uint32_t> primitiveIndices;
+};
+
+bool loadMeshCache(const MeshSource& source, MeshCacheData& data);
+bool saveMeshCache(const MeshSource& source, const MeshCacheData& data);
@@ -33,16 +33,24 @@
 
 #include "scene_lua.hpp"
 
+#include <algorithm>
 #include <cctype>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <sstream>
 #include <vector>
 
+#include <glm/ext.hpp>
+#include <glm/gtx/transform.hpp>
+
 #include "animation/Animation.hpp"
 #include "core/RayTracer.hpp"
+#include "core/Threads.hpp"
 #include "geometry/GeometryNode.hpp"
+#include "geometry/InstanceNode.hpp"
 #include "geometry/JointNode.hpp"
 #include "geometry/Primitive.hpp"
 #include "lighting/Light.hpp"
@@ -55,6 +63,13 @@
 typedef std::map<std::string, Mesh*> MeshMap;
 static MeshMap mesh_map;
 
+// Render settings given on the command line, which replace the ones passed to gr.render
+static std::map<std::string, std::string> render_overrides;
+
+// Whether loading the scene prints timings, which only the command line can turn off as
+// meshes load before the settings of gr.render are read
+static bool loading_logs = true;
+
 // Uncomment the following line to enable debugging messages
 // #define GRLUA_ENABLE_DEBUG
 
@@ -123,6 +138,184 @@ void get_tuple(lua_State* L, int arg, T* data, int n)
     }
 }
 
+// Retrieve an optional number field of a table, which may also be given as a string
+static lua_Number opt_number_field(lua_State* L, int arg, const char* name, lua_Number def)
+{
+    lua_getfield(L, arg, name);
+    int isNumber = 1;
+    const lua_Number value = lua_isnil(L, -1) ? def : lua_tonumberx(L, -1, &isNumber);
+    lua_pop(L, 1);
+    if (!isNumber)
+    {
+        luaL_argerror(L, arg, lua_pushfstring(L, "%s must be a number", name));
+    }
+    return value;
+}
+
+// Retrieve an optional integer field of a table, which may also be given as a string
+static lua_Integer opt_integer_field(
+    lua_State* L,
+    int arg,
+    const char* name,
+    lua_Integer def
+)
+{
+    lua_getfield(L, arg, name);
+    int isInteger = 1;
+    const lua_Integer value = lua_isnil(L, -1) ? def : lua_tointegerx(L, -1, &isInteger);
+    lua_pop(L, 1);
+    if (!isInteger)
+    {
+        luaL_argerror(L, arg, lua_pushfstring(L, "%s must be an integer", name));
+    }
+    return value;
+}
+
+// Retrieve an optional boolean field of a table, which may also be given as a string
+static bool opt_boolean_field(lua_State* L, int arg, const char* name, bool def)
+{
+    lua_getfield(L, arg, name);
+    bool value = def;
+    bool isBoolean = true;
+    if (lua_type(L, -1) == LUA_TSTRING)
+    {
+        const std::string text = lua_tostring(L, -1);
+        value = text == "true";
+        isBoolean = value || text == "false";
+    }
+    else if (!lua_isnil(L, -1))
+    {
+        value = lua_toboolean(L, -1);
+        isBoolean = lua_isboolean(L, -1);
+    }
+    lua_pop(L, 1);
+    if (!isBoolean)
+    {
+        luaL_argerror(L, arg, lua_pushfstring(L, "%s must be a boolean", name));
+    }
+    return value;
+}
+
+// Retrieve the optional table of render settings, with the command line overrides
+static RenderSettings get_render_settings(lua_State* L, int arg)
+{
+    const char* names[] = {"samples", "min_samples", "max_samples", "threshold", "budget",
+                           "noise", "checkpoint", "depth", "threads", "tile_size", "seed",
+                           "output", "logs", "frames", "shard", "workers", "report",
+                           "serve", "connect"};
+
+    // Write the overrides into the table, so they are read like the rest
+    lua_settop(L, std::max(lua_gettop(L), arg));
+    if (lua_isnil(L, arg))
+    {
+        lua_newtable(L);
+        lua_replace(L, arg);
+    }
+    luaL_checktype(L, arg, LUA_TTABLE);
+    for (const auto& [name, value]: render_overrides)
+    {
+        if (std::find(std::begin(names), std::end(names), name) == std::end(names))
+        {
+            luaL_error(L, "Unknown render setting '%s'", name.c_str());
+        }
+        lua_pushstring(L, value.c_str());
+        lua_setfield(L, arg, name.c_str());
+    }
+
+    RenderSettings settings;
+    const lua_Integer samples = opt_integer_field(L, arg, "samples", SAMPLE_SIZE);
+    settings.minSamples = opt_integer_field(L, arg, "min_samples", samples);
+    settings.maxSamples = opt_integer_field(L, arg, "max_samples", settings.minSamples);
+    settings.threshold = opt_number_field(L, arg, "threshold", ADAPTIVE_THRESHOLD);
+    settings.timeBudget = opt_number_field(L, arg, "budget", 0.0);
+    settings.noiseTarget = opt_number_field(L, arg, "noise", 0.0);
+    settings.checkpoint = opt_number_field(L, arg, "checkpoint", 0.0);
+    settings.maxDepth = opt_integer_field(L, arg, "depth", MAX_DEPTH);
+    const lua_Integer threads = opt_integer_field(L, arg, "threads", 0);
+    settings.tileSize = opt_integer_field(L, arg, "tile_size", TILE_SIZE);
+    const lua_Integer seed = opt_integer_field(L, arg, "seed", 0);
+    settings.logs = opt_boolean_field(L, arg, "logs", true);
+
+    const lua_Integer workers = opt_integer_field(L, arg, "workers", 0);
+
+    lua_getfield(L, arg, "output");
+    settings.output = luaL_optstring(L, -1, "");
+    lua_getfield(L, arg, "report");
+    settings.report = luaL_optstring(L, -1, "");
+    lua_getfield(L, arg, "frames");
+    const std::string frames = luaL_optstring(L, -1, "");
+    lua_getfield(L, arg, "shard");
+    const std::string shard = luaL_optstring(L, -1, "");
+    lua_getfield(L, arg, "serve");
+    settings.serve = luaL_optstring(L, -1, "");
+    lua_getfield(L, arg, "connect");
+    const std::string connect = luaL_optstring(L, -1, "");
+    lua_pop(L, 6);
+
+    // Frames are given as "first:last", or a single frame
+    if (!frames.empty())
+    {
+        char end = 0;
+        const int count = sscanf(frames.c_str(), "%d:%d%c", &settings.firstFrame,
+                                 &settings.lastFrame, &end);
+        if (count == 1)
+        {
+            settings.lastFrame = settings.firstFrame;
+        }
+        luaL_argcheck(L, (count == 1 && frames.find(':') == std::string::npos) ||
+                         count == 2, arg, "frames must be first:last");
+        luaL_argcheck(L, settings.firstFrame <= settings.lastFrame, arg,
+                      "frames must not end before they start");
+    }
+
+    // Shards are given as "index/count", with indices from 0
+    if (!shard.empty())
+    {
+        char end = 0;
+        const int count = sscanf(shard.c_str(), "%d/%d%c", &settings.shard,
+                                 &settings.numShards, &end);
+        luaL_argcheck(L, count == 2, arg, "shard must be index/count");
+        luaL_argcheck(L, settings.numShards >= 1 && settings.shard >= 0 &&
+                         settings.shard < settings.numShards, arg,
+                      "shard index must be from 0 to the count - 1");
+    }
+
+    // Workers are given as a list of addresses separated by commas
+    std::stringstream addresses(connect);
+    std::string address;
+    while (std::getline(addresses, address, ','))
+    {
+        if (!address.empty())
+        {
+            settings.connect.push_back(address);
+        }
+    }
+    const bool distributed = !settings.serve.empty() || !settings.connect.empty();
+    luaL_argcheck(L, settings.serve.empty() || settings.connect.empty(), arg,
+                  "serve and connect can not be used together");
+    luaL_argcheck(L, !distributed || (workers == 0 && !settings.progressive()), arg,
+                  "serve and connect do not work with workers, budget or noise");
+
+    luaL_argcheck(L, settings.minSamples >= 1, arg, "samples must be at least 1");
+    luaL_argcheck(L, settings.maxSamples >= settings.minSamples, arg,
+                  "max_samples must not be less than min_samples");
+    luaL_argcheck(L, settings.maxSamples == settings.minSamples || settings.minSamples >= 2,
+                  arg, "min_samples must be at least 2 to take more in noisy pixels");
+    luaL_argcheck(L, settings.threshold >= 0.0f, arg, "threshold must not be negative");
+    luaL_argcheck(L, settings.timeBudget >= 0.0f, arg, "budget must not be negative");
+    luaL_argcheck(L, settings.noiseTarget >= 0.0f, arg, "noise must not be negative");
+    luaL_argcheck(L, settings.checkpoint >= 0.0f, arg, "checkpoint must not be negative");
+    luaL_argcheck(L, settings.maxDepth >= 0, arg, "depth must not be negative");
+    luaL_argcheck(L, threads >= 0, arg, "threads must not be negative");
+    luaL_argcheck(L, settings.tileSize >= 1, arg, "tile_size must be at least 1");
+    luaL_argcheck(L, seed >= 0, arg, "seed must not be negative");
+    luaL_argcheck(L, workers >= 0, arg, "workers must not be negative");
+    settings.workers = static_cast<unsigned int>(workers);
+    settings.threads = static_cast<unsigned int>(threads);
+    settings.seed = static_cast<uint32_t>(seed);
+    return settings;
+}
+
 // Create a Node
 extern "C"
 int gr_node_cmd(lua_State* L)
@@ -273,7 +466,7 @@ int gr_mesh_cmd(lua_State* L)
 
     if (i == mesh_map.end())
     {
-        mesh = new Mesh(obj_fname);
+        mesh = new Mesh(obj_fname, loading_logs);
         mesh_map[sfname] = mesh;
     }
     else
@@ -289,6 +482,119 @@ int gr_mesh_cmd(lua_State* L)
     return 1;
 }
 
+// Retrieve and check the instance at index i of the table of instances at arg, made into
+// its model to world transformation and the index of its material in the list of
+// numMaterials materials
+static void get_instance(
+    lua_State* L,
+    int arg,
+    int i,
+    int numMaterials,
+    glm::mat4& trans,
+    uint32_t& material
+)
+{
+    lua_rawgeti(L, arg, i);
+    luaL_checktype(L, -1, LUA_TTABLE);
+    int instance = lua_gettop(L);
+
+    glm::vec3 translation(0.0f), rotation(0.0f), scale(1.0f);
+    glm::vec3* tuples[] = {&translation, &rotation, &scale};
+    const char* fields[] = {"translate", "rotate", "scale"};
+    for (int j = 0; j < 3; j++)
+    {
+        lua_getfield(L, instance, fields[j]);
+        if (!lua_isnil(L, -1))
+        {
+            get_tuple(L, lua_gettop(L), &(*tuples[j])[0], 3);
+        }
+        lua_pop(L, 1);
+    }
+    luaL_argcheck(L, scale.x != 0.0f && scale.y != 0.0f && scale.z != 0.0f, arg,
+                  "Instance scale components must be nonzero");
+
+    lua_getfield(L, instance, "material");
+    int index = lua_isnil(L, -1) ? 1 : luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+    if (index < 1 || index > numMaterials)
+    {
+        luaL_error(L, "Instance %d has no material %d", i, index);
+    }
+
+    trans = glm::translate(translation) *
+            glm::rotate(glm::radians(rotation.z), glm::vec3(0, 0, 1)) *
+            glm::rotate(glm::radians(rotation.y), glm::vec3(0, 1, 0)) *
+            glm::rotate(glm::radians(rotation.x), glm::vec3(1, 0, 0)) *
+            glm::scale(scale);
+    material = static_cast<uint32_t>(index - 1);
+
+    lua_pop(L, 1);
+}
+
+// Create a node holding many instances of the primitive of a geometry node (usually a
+// mesh), each given as a table with optional translate, rotate (degrees about x, y then z)
+// and scale tuples, and the index of its material in the list of materials
+extern "C"
+int gr_instance_cmd(lua_State* L)
+{
+    GRLUA_DEBUG_CALL;
+
+    gr_node_ud* data = (gr_node_ud*) lua_newuserdata(L, sizeof(gr_node_ud));
+    data->node = 0;
+
+    const char* name = luaL_checkstring(L, 1);
+
+    gr_node_ud* geometrydata = (gr_node_ud*) luaL_checkudata(L, 2, "gr.node");
+    luaL_argcheck(L, geometrydata != 0, 2, "Node expected");
+    luaL_argcheck(L, geometrydata->node->m_nodeType == NodeType::GeometryNode, 2,
+                  "Geometry node expected");
+    Primitive* primitive = static_cast<GeometryNode*>(geometrydata->node)->m_primitive;
+
+    // Errors jump straight back to Lua without freeing anything, so every argument is
+    // checked before the materials and the node are allocated
+    luaL_checktype(L, 3, LUA_TTABLE);
+    int numMaterials = lua_rawlen(L, 3);
+    luaL_argcheck(L, numMaterials > 0, 3, "At least one material expected");
+    for (int i = 1; i <= numMaterials; i++)
+    {
+        lua_rawgeti(L, 3, i);
+        luaL_checkudata(L, -1, "gr.material");
+        lua_pop(L, 1);
+    }
+
+    luaL_checktype(L, 4, LUA_TTABLE);
+    int numInstances = lua_rawlen(L, 4);
+    glm::mat4 trans;
+    uint32_t material;
+    for (int i = 1; i <= numInstances; i++)
+    {
+        get_instance(L, 4, i, numMaterials, trans, material);
+    }
+
+    std::vector<Material*> materials;
+    for (int i = 1; i <= numMaterials; i++)
+    {
+        lua_rawgeti(L, 3, i);
+        materials.push_back(((gr_material_ud*) lua_touserdata(L, -1))->material);
+        lua_pop(L, 1);
+    }
+
+    InstanceNode* node = new InstanceNode(name, primitive, materials);
+    for (int i = 1; i <= numInstances; i++)
+    {
+        get_instance(L, 4, i, numMaterials, trans, material);
+        node->addInstance(trans, material);
+    }
+    node->buildHierarchy();
+
+    data->node = node;
+
+    luaL_getmetatable(L, "gr.node");
+    lua_setmetatable(L, -2);
+
+    return 1;
+}
+
 // Make a Point light
 extern "C"
 int gr_light_cmd(lua_State* L)
@@ -415,9 +721,16 @@ int gr_render_cmd(lua_State* L)
         lua_pop(L, 1);
     }
 
+    // Optional fraction of a frame the shutter stays open for, to blur moving nodes
+    double shutter = luaL_optnumber(L, 14, 0.0);
+    luaL_argcheck(L, shutter >= 0.0, 14, "Shutter must not be negative");
+
+    // Optional table of settings, such as the samples per pixel and number of threads
+    const RenderSettings settings = get_render_settings(L, 15);
+
     Image im(width, height);
     A5_Render(root->node, im, filename, startFrame, numFrames,
-              eye, view, up, fov, ambient, lights, particles);
+              eye, view, up, fov, ambient, lights, particles, shutter, settings);
 
     return 0;
 }
@@ -719,6 +1032,7 @@ static const luaL_Reg grlib_functions[] = {
     {"nh_sphere", gr_nh_sphere_cmd},
     {"nh_box", gr_nh_box_cmd},
     {"mesh", gr_mesh_cmd},
+    {"instance", gr_instance_cmd},
     {"light", gr_light_cmd},
     {"render", gr_render_cmd},
     {0, 0}
@@ -751,8 +1065,22 @@ static const luaL_Reg grlib_node_methods[] = {
 
 // This function calls the lua interpreter to define the scene and
 // raytrace it as appropriate.
-bool run_lua(const std::string& filename)
+bool run_lua(
+    const std::string& filename,
+    const std::map<std::string, std::string>& settings
+)
 {
+    render_overrides = settings;
+    const auto logs = settings.find("logs");
+    loading_logs = logs == settings.end() || logs->second != "false";
+
+    // Threads on the command line already apply to the hierarchies built while loading
+    const auto threads = settings.find("threads");
+    if (threads != settings.end())
+    {
+        setWorkerThreadCount(std::max(0, std::atoi(threads->second.c_str())));
+    }
+
     GRLUA_DEBUG("Importing scene from " << filename);
 
     // Start a lua interpreter
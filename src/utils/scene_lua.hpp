@@ -1,5 +1,11 @@
 #pragma once
 
+#include <map>
 #include <string>
 
-bool run_lua(const std::string& filename);
+// Runs a scene file, with render settings by name replacing the ones it passes to
+// gr.render, e.g. {"samples", "16"}
+bool run_lua(
+    const std::string& filename,
+    const std::map<std::string, std::string>& settings = {}
+);
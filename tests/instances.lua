@@ -0,0 +1,53 @@
+-- Instancing test: a forest of 10000 trees and bushes sharing two meshes
+
+math.randomseed(488)
+
+green = gr.material({0.1, 0.7, 0.1}, {0.0, 0.0, 0.0}, 0)
+dark_green = gr.material({0.05, 0.3, 0.034}, {0.0, 0.0, 0.0}, 0)
+light_green = gr.material({0.3, 0.6, 0.1}, {0.0, 0.0, 0.0}, 0)
+snow = gr.material({0.8, 0.8, 0.8}, {0.0, 0.0, 0.0}, 0)
+
+scene = gr.node('scene')
+
+-- The ground
+ground = gr.cube('ground')
+scene:add_child(ground)
+ground:set_material(snow)
+ground:scale(400, 1, 400)
+ground:translate(-200, -1, -400)
+
+-- The meshes are modelled away from the origin, so every instance is first moved back
+leaves = gr.mesh('leaves', 'assets/TreeLeavesM_001.obj')
+bush = gr.mesh('bush', 'assets/BushS_001.obj')
+
+trees = {}
+bushes = {}
+for i = 0, 99 do
+    for j = 0, 99 do
+        x = (i - 50) * 4 + math.random() * 2
+        z = -j * 4 - math.random() * 2
+        if math.random() < 0.8 then
+            s = 0.7 + 0.6 * math.random()
+            trees[#trees + 1] = {
+                translate = {x + 31.63 * s, -0.08 * s, z - 5.52 * s},
+                scale = {s, s, s},
+                material = math.random(1, 2)
+            }
+        else
+            bushes[#bushes + 1] = {
+                translate = {x - 19.81, 5.98, z - 7.19},
+                material = 3
+            }
+        end
+    end
+end
+
+scene:add_child(gr.instance('trees', leaves, {green, dark_green}, trees))
+scene:add_child(gr.instance('bushes', bush, {green, dark_green, light_green}, bushes))
+
+-- The lights
+l1 = gr.light({100, 300, 200}, {0.8, 0.8, 0.8}, {1, 0, 0})
+
+gr.render(scene, 'tests/instances', 256, 256, 1, 1,
+	  {0, 30, 20}, {0, 0, -100}, {0, 1, 0}, 50,
+	  {0.4, 0.4, 0.4}, {l1}, {})
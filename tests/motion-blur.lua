@@ -0,0 +1,39 @@
+-- Motion blur test: two spheres moving while the shutter is open, next to a still one
+
+red = gr.material({0.9, 0.2, 0.2}, {0.5, 0.5, 0.5}, 25)
+blue = gr.material({0.2, 0.3, 0.9}, {0.5, 0.5, 0.5}, 25)
+grey = gr.material({0.6, 0.6, 0.6}, {0.2, 0.2, 0.2}, 10)
+
+scene = gr.node('scene')
+
+floor = gr.cube('floor')
+scene:add_child(floor)
+floor:set_material(grey)
+floor:scale(40, 1, 40)
+floor:translate(-20, -3, -30)
+
+-- Rises by 0.72 every frame
+riser = gr.sphere('riser')
+scene:add_child(riser)
+riser:set_material(red)
+riser:translate(-2.5, -2, -4)
+riser:set_animation(0, 100, 't', 'up')
+
+-- Falls to the right, faster every frame
+faller = gr.sphere('faller')
+scene:add_child(faller)
+faller:set_material(blue)
+faller:translate(0, 3, -6)
+faller:set_animation(0, 100, 't', 'rightFall')
+
+still = gr.sphere('still')
+scene:add_child(still)
+still:set_material(grey)
+still:translate(3, -1, -4)
+
+l1 = gr.light({-10, 20, 20}, {0.9, 0.9, 0.9}, {1, 0, 0})
+
+-- The shutter stays open for the whole frame
+gr.render(scene, 'tests/motion-blur', 256, 256, 4, 1,
+	  {0, 2, 12}, {0, 0, -4}, {0, 1, 0}, 50,
+	  {0.3, 0.3, 0.3}, {l1}, {}, 1.0)
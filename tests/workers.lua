@@ -0,0 +1,25 @@
+-- Render job test: the scene asks for worker processes itself, which must render the
+-- frames instead of starting workers of their own
+
+red = gr.material({0.9, 0.2, 0.2}, {0.5, 0.5, 0.5}, 25)
+grey = gr.material({0.6, 0.6, 0.6}, {0.2, 0.2, 0.2}, 10)
+
+scene = gr.node('scene')
+
+floor = gr.cube('floor')
+scene:add_child(floor)
+floor:set_material(grey)
+floor:scale(40, 1, 40)
+floor:translate(-20, -3, -30)
+
+ball = gr.sphere('ball')
+scene:add_child(ball)
+ball:set_material(red)
+ball:translate(0, -1, -4)
+
+l1 = gr.light({-10, 20, 20}, {0.9, 0.9, 0.9}, {1, 0, 0})
+
+gr.render(scene, 'tests/workers', 64, 64, 1, 2,
+	  {0, 2, 12}, {0, 0, -4}, {0, 1, 0}, 50,
+	  {0.3, 0.3, 0.3}, {l1}, {}, 0,
+	  {workers = 2, samples = 1})